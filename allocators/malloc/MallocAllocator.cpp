@@ -1,39 +1,40 @@
 #include "MallocAllocator.h"
 
-template<class T>
+inline void Reporting::report(void* p, std::size_t bytes, bool alloc)
+{
+    std::cout << (alloc ? "Alloc: " : "Dealloc: ") << bytes
+              << " bytes at " << std::hex << std::showbase
+              << p << std::dec << '\n';
+}
+
+template<class T, class Policy>
 template<class U>
-constexpr MallocAllocator<T>::MallocAllocator(const MallocAllocator <U>&) noexcept {}
+constexpr MallocAllocator<T, Policy>::MallocAllocator(const MallocAllocator <U, Policy>& other) noexcept
+    : Policy(other) {}
 
-template<class T>
-[[maybe_unused]] T* MallocAllocator<T>::allocate(std::size_t n) {
+template<class T, class Policy>
+[[maybe_unused]] T* MallocAllocator<T, Policy>::allocate(std::size_t n) {
     if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
         throw std::bad_array_new_length();
 
     if (auto p = static_cast<T*>(std::malloc(n * sizeof(T))))
     {
-        report(p, n);
+        Policy::allocated(p, n * sizeof(T));
         return p;
     }
 
+    Policy::failed(n * sizeof(T));
     throw std::bad_alloc();
 }
 
-template<class T>
-[[maybe_unused]] void MallocAllocator<T>::deallocate(T* p, std::size_t n) noexcept {
-    report(p, n, 0);
+template<class T, class Policy>
+[[maybe_unused]] void MallocAllocator<T, Policy>::deallocate(T* p, std::size_t n) noexcept {
+    Policy::deallocated(p, n * sizeof(T));
     std::free(p);
 }
 
-template<class T>
-void MallocAllocator<T>::report(T* p, std::size_t n, bool alloc) const
-{
-    std::cout << (alloc ? "Alloc: " : "Dealloc: ") << sizeof(T) * n
-              << " bytes at " << std::hex << std::showbase
-              << reinterpret_cast<void*>(p) << std::dec << '\n';
-}
-
-template<class T, class U>
-bool operator==(const MallocAllocator <T>&, const MallocAllocator <U>&) { return true; }
+template<class T, class U, class Policy>
+bool operator==(const MallocAllocator <T, Policy>&, const MallocAllocator <U, Policy>&) { return true; }
 
-template<class T, class U>
-bool operator!=(const MallocAllocator <T>&, const MallocAllocator <U>&) { return false; }
\ No newline at end of file
+template<class T, class U, class Policy>
+bool operator!=(const MallocAllocator <T, Policy>&, const MallocAllocator <U, Policy>&) { return false; }
\ No newline at end of file
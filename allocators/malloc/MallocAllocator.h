@@ -7,28 +7,47 @@
 #include <new>
 #include <vector>
 
-template<class T>
-struct MallocAllocator
+/**
+ * Default policy, printing every call
+ */
+struct Reporting
+{
+    void allocated(void* p, std::size_t bytes) { report(p, bytes, true); }
+
+    void deallocated(void* p, std::size_t bytes) { report(p, bytes, false); }
+
+    void failed(std::size_t) {}
+
+private:
+    static void report(void* p, std::size_t bytes, bool alloc);
+};
+
+template<class T, class Policy = Reporting>
+struct MallocAllocator : Policy
 {
     [[maybe_unused]] typedef T value_type;
 
     MallocAllocator() = default;
 
+    /**
+     * Construct with a policy of its own, such as a Tracing policy recording to a file
+     * @param policy instrumentation policy, shared by copies of the allocator
+     */
+    explicit MallocAllocator(const Policy& policy) : Policy(policy) {}
+
     template<class U>
-    constexpr explicit MallocAllocator(const MallocAllocator <U>&) noexcept;
+    constexpr explicit MallocAllocator(const MallocAllocator <U, Policy>& other) noexcept;
 
     [[maybe_unused]] T* allocate(std::size_t n);
 
     [[maybe_unused]] void deallocate(T* p, std::size_t n) noexcept;
-private:
-    void report(T* p, std::size_t n, bool alloc = true) const;
 };
 
-template<class T, class U>
-bool operator==(const MallocAllocator <T>&, const MallocAllocator <U>&);
+template<class T, class U, class Policy>
+bool operator==(const MallocAllocator <T, Policy>&, const MallocAllocator <U, Policy>&);
 
-template<class T, class U>
-bool operator!=(const MallocAllocator <T>&, const MallocAllocator <U>&);
+template<class T, class U, class Policy>
+bool operator!=(const MallocAllocator <T, Policy>&, const MallocAllocator <U, Policy>&);
 
 
 #endif //WRITEQUEUECPP_MALLOCALLOCATOR_H
@@ -0,0 +1,488 @@
+#include "Arena.h"
+#include "ThreadCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <new>
+#include <sched.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+Arena::Arena(size_t heap_size, int shards) : Arena(heap_size, Config{shards}) {}
+
+Arena::Arena(size_t heap_size, const Config& config) : config(config) {
+    assert(sizeof(SignPost) <= MINIMUM);
+    assert(config.shards > 0 && config.shards <= REGIONS);
+
+    //Keep every shard, and therefore its lock and bitmaps, on its own pages
+    for (int i = 0; i < config.shards; i++) {
+        size_t mapping = 0;
+        char* start = reserve(heap_size, mapping);
+        if (start == nullptr) {
+            for (int j = 0; j < i; j++) {
+                munmap(regions[j].first(), regions[j].mapping);
+            }
+            throw std::bad_alloc();
+        }
+        add(start, heap_size, mapping);
+    }
+
+    //A shard only a few slabs large would mostly hold partially used slabs
+    if (heap_size < 64 * SLAB) {
+        this->config.slabs = false;
+    }
+    for (int s = 0; s <= SLABBED / GRAIN; s++) {
+        slabs[s].size = s * GRAIN;
+    }
+    ThreadCache::enlist(this);
+}
+
+Arena::~Arena() {
+    ThreadCache::retire(this);
+
+    for (size_t i = 0; i < mappings.capacity; i++) {
+        Registry::Entry& entry = mappings.table[i];
+        if (entry.start && entry.start != (char*) -1) {
+            munmap(entry.start, entry.len);
+        }
+    }
+    for (int i = 0; i < count.load(std::memory_order_relaxed); i++) {
+        munmap(regions[i].first(), regions[i].mapping);
+    }
+    for (Index* old = index.load(std::memory_order_relaxed); old;) {
+        Index* next = old->retired;
+        munmap(old, sizeof(Index));
+        old = next;
+    }
+}
+
+void Arena::add(char* start, size_t len, size_t mapping) {
+    int i = count.load(std::memory_order_relaxed);
+    Region& region = regions[i];
+    region.start = start;
+    region.end = start + len;
+    region.mapping = mapping;
+    //Fresh anonymous mappings read as zero, so the tree need not clear its metadata
+    adopt(&region.tree, start, (long) len);
+    for (int level = 0; level < region.tree.layers; level++) {
+        defer(&region.tree, level, config.deferred);
+    }
+    mapped += len;
+
+    //Insert into a copy of the index so readers never see it half sorted
+    Index* old = index.load(std::memory_order_relaxed);
+    void* fresh = mmap(nullptr, sizeof(Index), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (fresh == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+    auto* next = new (fresh) Index();
+    next->retired = old;
+    next->count = old ? old->count : 0;
+    std::copy(old ? old->regions : nullptr, old ? old->regions + old->count : nullptr, next->regions);
+    Region** at = std::upper_bound(next->regions, next->regions + next->count, &region,
+                                   [](Region* a, Region* b) { return a->start < b->start; });
+    std::copy_backward(at, next->regions + next->count, next->regions + next->count + 1);
+    *at = &region;
+    next->count++;
+
+    count.store(i + 1, std::memory_order_release);
+    index.store(next, std::memory_order_release);
+}
+
+bool Arena::grow(long size, int seen) {
+    std::lock_guard<std::mutex> guard(growing);
+    int now = count.load(std::memory_order_relaxed);
+    if (now > seen) {
+        return true;
+    }
+    if (now == REGIONS) {
+        return false;
+    }
+
+    //Grow geometrically, but always leave room for the request next to the new tree's metadata
+    Region& last = regions[now - 1];
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t len = std::max((size_t) ((double) (last.end - last.start) * config.growth),
+                          ((size_t) MINIMUM << rank(size)) * 2);
+    len = (len + page - 1) / page * page;
+    if (config.limit && mapped + len > config.limit) {
+        return false;
+    }
+
+    size_t mapping = 0;
+    char* start = reserve(len, mapping);
+    if (start == nullptr) {
+        return false;
+    }
+    add(start, len, mapping);
+    return true;
+}
+
+char* Arena::reserve(size_t len, size_t& mapping) {
+    //Reserve room to slide the tree until its heap starts on a multiple of its largest block. The heap is only
+    //reserved, its pages and those of its metadata are committed as they are first used.
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t lead = (size_t) prelude((long) len);
+    size_t align = (size_t) 1 << (63 - __builtin_clzl(len > lead + MINIMUM ? len - lead : MINIMUM));
+    size_t span = (len + align + page - 1) / page * page;
+    char* p = (char*) mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    //Give back the pages on either side of the tree
+    char* start = (char*) (((uintptr_t) p + lead + align - 1) / align * align) - lead;
+    char* first = (char*) ((uintptr_t) start / page * page);
+    char* last = (char*) (((uintptr_t) start + len + page - 1) / page * page);
+    if (first > p) {
+        munmap(p, (size_t) (first - p));
+    }
+    if (p + span > last) {
+        munmap(last, (size_t) (p + span - last));
+    }
+    mapping = (size_t) (last - first);
+    return start;
+}
+
+int Arena::pick() const {
+    if (config.shards == 1) {
+        return 0;
+    }
+
+    //Follow the CPU when the kernel reports it, otherwise spread threads round-robin
+    int cpu = sched_getcpu();
+    if (cpu < 0) {
+        static std::atomic<int> tickets{0};
+        thread_local int ticket = tickets++;
+        cpu = ticket;
+    }
+    return cpu % config.shards;
+}
+
+PearTree* Arena::owner(void* pointer) const {
+    Index* sorted = index.load(std::memory_order_acquire);
+
+    //Find the last region starting at or before the pointer
+    int low = 0;
+    int high = sorted->count - 1;
+    while (low < high) {
+        int mid = (low + high + 1) / 2;
+        if (sorted->regions[mid]->start <= (char*) pointer) {
+            low = mid;
+        }
+        else {
+            high = mid - 1;
+        }
+    }
+    return &sorted->regions[low]->tree;
+}
+
+Region* Arena::within(void* pointer) const {
+    Index* sorted = index.load(std::memory_order_acquire);
+
+    //Only the last region starting at or before the pointer may contain it
+    Region** at = std::upper_bound(sorted->regions, sorted->regions + sorted->count, (char*) pointer,
+                                   [](char* p, Region* region) { return p < region->start; });
+    if (at == sorted->regions) {
+        return nullptr;
+    }
+    Region* region = at[-1];
+    return (char*) pointer >= (char*) region->tree.base && (char*) pointer < region->end ? region : nullptr;
+}
+
+size_t Arena::usable(void* pointer) {
+    if (Region* region = within(pointer)) {
+        //Objects never start a block, the header does
+        long size = measure(&region->tree, pointer);
+        return (size_t) (size ? size : Slabs::header(&region->tree, pointer)->size);
+    }
+    return mappings.find(pointer);
+}
+
+int Arena::drain(PearTree* tree, long size, void** blocks, int n) {
+    lock(tree);
+    int got = take_many(tree, size, blocks, n);
+    unlock(tree);
+    return got;
+}
+
+int Arena::refill(long size, void** blocks, int n) {
+    int s = slot(size);
+    if (s >= 0) {
+        return slabs[s].take(this, blocks, n);
+    }
+
+    int first = pick();
+    int got = drain(&regions[first].tree, size, blocks, n);
+
+    //Newest regions first, they are the largest and the least fragmented
+    int seen = count.load(std::memory_order_acquire);
+    for (int i = seen - 1; i >= 0 && got < n; i--) {
+        if (i != first) {
+            got += drain(&regions[i].tree, size, blocks + got, n - got);
+        }
+    }
+
+    while (got == 0 && config.growable && grow(size, seen)) {
+        seen = count.load(std::memory_order_acquire);
+        got = drain(&regions[seen - 1].tree, size, blocks, n);
+    }
+    return got;
+}
+
+void Arena::release(long size, void** blocks, int n) {
+    int s = slot(size);
+    if (s >= 0) {
+        slabs[s].give(this, blocks, n);
+        return;
+    }
+
+    for (int i = 0; i < n;) {
+        PearTree* tree = owner(blocks[i]);
+        int run = 1;
+        while (i + run < n && owner(blocks[i + run]) == tree) {
+            run++;
+        }
+        lock(tree);
+        if (run == 1) {
+            give_sized(tree, blocks[i], size);
+        }
+        else {
+            give_many(tree, blocks + i, run);
+        }
+        unlock(tree);
+        i += run;
+    }
+
+    //Trim once enough has been freed, unless another thread trimmed recently
+    if (config.purge && freed.fetch_add(size * n, std::memory_order_relaxed) + size * n >= config.purge) {
+        long now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        long last = trimmed.load(std::memory_order_relaxed);
+        if (now - last >= config.decay && trimmed.compare_exchange_strong(last, now)) {
+            freed.store(0, std::memory_order_relaxed);
+            trim();
+        }
+    }
+}
+
+size_t Arena::trim() {
+    long page = sysconf(_SC_PAGESIZE);
+    size_t released = 0;
+    for (int i = 0; i < count.load(std::memory_order_acquire); i++) {
+        lock(&regions[i].tree);
+        released += (size_t) ::trim(&regions[i].tree, page, config.lazy ? MADV_FREE : MADV_DONTNEED);
+        unlock(&regions[i].tree);
+    }
+    return released;
+}
+
+long Arena::coalesce() {
+    long merged = 0;
+    for (int i = 0; i < count.load(std::memory_order_acquire); i++) {
+        lock(&regions[i].tree);
+        merged += ::coalesce(&regions[i].tree);
+        unlock(&regions[i].tree);
+    }
+    return merged;
+}
+
+double Arena::overhead() const {
+    size_t metadata = 0;
+    size_t heap = 0;
+    for (int i = 0; i < count.load(std::memory_order_acquire); i++) {
+        const PearTree& tree = regions[i].tree;
+        metadata += (size_t) ((char*) tree.base - tree.alloc);
+        heap += (size_t) ((char*) tree.end - (char*) tree.base);
+    }
+    return heap ? (double) metadata / (double) heap : 0;
+}
+
+void* Arena::map(long size, size_t align) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    size_t len = ((size_t) size + page - 1) / page * page;
+    size_t slack = align > page ? align - page : 0;
+    char* p = (char*) mmap(nullptr, len + slack, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        return nullptr;
+    }
+
+    //Mappings are only page aligned, cut off whatever lies outside the aligned part
+    if (slack) {
+        char* start = (char*) (((uintptr_t) p + align - 1) / align * align);
+        if (start > p) {
+            munmap(p, (size_t) (start - p));
+        }
+        if (p + slack > start) {
+            munmap(start + len, (size_t) (p + slack - start));
+        }
+        p = start;
+    }
+    if (!mappings.insert(p, len)) {
+        munmap(p, len);
+        return nullptr;
+    }
+    return p;
+}
+
+void Arena::unmap(void* pointer) {
+    if (size_t len = mappings.remove(pointer)) {
+        munmap(pointer, len);
+    }
+}
+
+void* Arena::allocate(long size) {
+    if (large(size)) {
+        return map(size);
+    }
+    if (ThreadCache* cache = ThreadCache::local(this)) {
+        return cache->take(size);
+    }
+    void* p = nullptr;
+    refill(size, &p, 1);
+    return p;
+}
+
+void Arena::deallocate(void* pointer, long size) {
+    if (pointer == nullptr) {
+        return;
+    }
+    if (large(size)) {
+        unmap(pointer);
+        return;
+    }
+    if (ThreadCache* cache = ThreadCache::local(this)) {
+        cache->give(pointer, size);
+        return;
+    }
+    release(size, &pointer, 1);
+}
+
+void Arena::deallocate(void* pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    Region* region = within(pointer);
+    if (region == nullptr) {
+        unmap(pointer);
+        return;
+    }
+    long size = measure(&region->tree, pointer);
+    if (size == 0) {
+        size = Slabs::header(&region->tree, pointer)->size;
+    }
+    if (ThreadCache* cache = ThreadCache::local(this)) {
+        cache->give(pointer, size);
+        return;
+    }
+    release(size, &pointer, 1);
+}
+
+void* Arena::aligned(long size, size_t align) {
+    if (align <= MINIMUM) {
+        return allocate(size);
+    }
+
+    //Blocks are aligned to their own size, so a block at least as large as the alignment is aligned enough
+    long bytes = std::max((long) align, (long) MINIMUM << rank(size));
+    if (large(bytes)) {
+        return map(size, align);
+    }
+    return allocate(bytes);
+}
+
+size_t Arena::capacity(long size) const {
+    if (large(size)) {
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        return ((size_t) size + page - 1) / page * page;
+    }
+    int s = slot(size);
+    return s >= 0 ? (size_t) s * GRAIN : (size_t) MINIMUM << rank(size);
+}
+
+bool Arena::try_expand(void* pointer, long old, long size) {
+    //Slab objects, blocks and mappings never turn into one another
+    if (slot(old) >= 0 || slot(size) >= 0) {
+        return slot(old) == slot(size);
+    }
+    if (large(old) != large(size) || size < old) {
+        return false;
+    }
+
+    //Large allocations grow only if the pages after them are free
+    if (large(old)) {
+        size_t before = mappings.find(pointer);
+        size_t len = capacity(size);
+        if (len > before) {
+            if (mremap(pointer, before, len, 0) == MAP_FAILED) {
+                return false;
+            }
+            mappings.resize(pointer, len);
+        }
+        return true;
+    }
+
+    PearTree* tree = owner(pointer);
+    lock(tree);
+    bool grown = expand(tree, pointer, size);
+    unlock(tree);
+    return grown;
+}
+
+bool Arena::shrink_in_place(void* pointer, long old, long size) {
+    //Slab objects, blocks and mappings never turn into one another
+    if (slot(old) >= 0 || slot(size) >= 0) {
+        return slot(old) == slot(size);
+    }
+    if (large(old) != large(size) || size > old) {
+        return false;
+    }
+
+    if (large(old)) {
+        size_t before = mappings.find(pointer);
+        size_t len = capacity(size);
+        if (len < before) {
+            munmap((char*) pointer + len, before - len);
+            mappings.resize(pointer, len);
+        }
+        return true;
+    }
+
+    PearTree* tree = owner(pointer);
+    lock(tree);
+    shrink(tree, pointer, size);
+    unlock(tree);
+    return true;
+}
+
+void* Arena::reallocate(void* pointer, long old, long size) {
+    //Let the kernel move the pages of a large allocation rather than copying them
+    size_t before = pointer && large(old) ? mappings.find(pointer) : 0;
+    if (before && large(size)) {
+        size_t page = (size_t) sysconf(_SC_PAGESIZE);
+        size_t len = ((size_t) size + page - 1) / page * page;
+        void* p = mremap(pointer, before, len, MREMAP_MAYMOVE);
+        if (p == MAP_FAILED) {
+            return nullptr;
+        }
+        if (p == pointer) {
+            mappings.resize(p, len);
+            return p;
+        }
+        //Move the pages back if the new address cannot be recorded, the old one still is
+        if (!mappings.insert(p, len)) {
+            mremap(p, len, before, MREMAP_MAYMOVE | MREMAP_FIXED, pointer);
+            return nullptr;
+        }
+        mappings.remove(pointer);
+        return p;
+    }
+
+    void* p = allocate(size);
+    if (p && pointer) {
+        memcpy(p, pointer, (size_t) std::min(old, size));
+        deallocate(pointer, old);
+    }
+    return p;
+}
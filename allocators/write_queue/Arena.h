@@ -0,0 +1,326 @@
+#ifndef WRITEQUEUECPP_ARENA_H
+#define WRITEQUEUECPP_ARENA_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unistd.h>
+
+extern "C" {
+    #include "peartree.h"
+}
+
+#include "Registry.h"
+#include "Slab.h"
+
+//Most regions an arena can hold, shards included
+#define REGIONS 128
+
+/**
+ * Arena configuration
+ */
+struct Config
+{
+    //Independent trees carved out of the initial mapping
+    int shards = 1;
+
+    //Whether further regions are mapped once every tree is exhausted
+    bool growable = false;
+
+    //Size of each new region relative to the previous one
+    double growth = 2;
+
+    //Most bytes the arena may map in total, zero for no limit
+    size_t limit = 0;
+
+    //Requests of at least this many bytes get a dedicated mapping instead of a block, zero to disable
+    size_t large = 1 << 20;
+
+    //Bytes given back to the trees before free pages are automatically trimmed, zero to only trim on demand
+    size_t purge = 0;
+
+    //Least milliseconds between two automatic trims, so that pages being reused are not released repeatedly
+    long decay = 1000;
+
+    //Release trimmed pages lazily with MADV_FREE, cheaper to reuse but only reclaimed under memory pressure
+    bool lazy = false;
+
+    //Serve small requests between powers of two from slabs, ignored for shards too small to hold many slabs
+    bool slabs = true;
+
+    //Merges of freed blocks each size class may put off at once, so blocks freed and taken again in turn are not
+    //merged and split every time, zero to merge eagerly
+    long deferred = 0;
+};
+
+/**
+ * A PearTree together with the address range it manages
+ */
+struct Region
+{
+    char* start;
+    char* end;
+    PearTree tree;
+
+    //Length of the mapping holding this region, which starts at the page holding start
+    size_t mapping;
+
+    char* first() const {
+        uintptr_t page = (uintptr_t) sysconf(_SC_PAGESIZE);
+        return (char*) ((uintptr_t) start / page * page);
+    }
+};
+
+/**
+ * A set of independent PearTrees. The initial mapping is split into shards, threads allocate from the
+ * shard of the CPU they run on, and a growable arena chains further regions once all of them are
+ * exhausted. Blocks are given back to the region whose address range contains them. Large requests
+ * bypass the trees and get a mapping of their own, returned to the system as soon as they are freed.
+ */
+struct Arena
+{
+    /**
+     * Regions sorted by address, replaced as a whole whenever a region is added. Indexes are mapped
+     * directly, so that an arena never allocates through the heap it may be serving.
+     */
+    struct Index
+    {
+        int count;
+        Region* regions[REGIONS];
+
+        //Index this one replaced, kept until the arena is destroyed since readers may still hold it
+        Index* retired;
+    };
+
+    Config config;
+    size_t mapped = 0;
+    Region regions[REGIONS];
+    std::atomic<int> count{0};
+    std::atomic<Index*> index{nullptr};
+    std::mutex growing;
+    Registry mappings;
+    std::atomic<size_t> freed{0};
+    std::atomic<long> trimmed{0};
+    Slabs slabs[SLABBED / GRAIN + 1];
+
+    //Identity and link in the list of live arenas, maintained by ThreadCache
+    unsigned long id = 0;
+    Arena* link = nullptr;
+
+    /**
+     * Map and initialize the shards
+     * @param heap_size bytes per shard
+     * @param shards number of independent trees
+     */
+    explicit Arena(size_t heap_size, int shards = 1);
+
+    /**
+     * Map and initialize the shards
+     * @param heap_size bytes per shard
+     * @param config arena configuration
+     */
+    Arena(size_t heap_size, const Config& config);
+
+    Arena(const Arena&) = delete;
+
+    /**
+     * Unmap every region and large allocation. Blocks other threads still cache are abandoned.
+     */
+    ~Arena();
+
+    /**
+     * Count the doublings of the minimum block needed to fit a request
+     * @param size size in bytes
+     * @return rank, the block serving the request holds MINIMUM << rank bytes
+     */
+    static int rank(long size) {
+        return size <= MINIMUM ? 0 : 64 - __builtin_clzl((size - 1) / MINIMUM);
+    }
+
+    /**
+     * Determine the slab class serving a request in this arena
+     * @param size size in bytes
+     * @return slab class, or -1 if the request is served by a block
+     */
+    int slot(long size) const {
+        return config.slabs ? Slabs::slot(size) : -1;
+    }
+
+    /**
+     * Choose the shard serving the calling thread
+     * @return shard index
+     */
+    int pick() const;
+
+    /**
+     * Find the tree that owns a block by binary search over the regions
+     * @param pointer block inside the arena
+     * @return owning tree
+     */
+    PearTree* owner(void* pointer) const;
+
+    /**
+     * Find the region holding a pointer, if any
+     * @param pointer any pointer
+     * @return region whose heap contains the pointer, or null for large allocations and foreign pointers
+     */
+    Region* within(void* pointer) const;
+
+    /**
+     * Determine how many bytes an allocation can actually hold
+     * @param pointer allocation taken from this arena
+     * @return size of its block or mapping in bytes
+     */
+    size_t usable(void* pointer);
+
+    /**
+     * Take up to n blocks of one size under as few lock acquisitions as possible, starting with the
+     * calling thread's shard, spilling over to the other regions when it is exhausted, and growing the
+     * arena when all of them are
+     * @param size size in bytes
+     * @param blocks output array of blocks
+     * @param n number of blocks wanted
+     * @return number of blocks taken
+     */
+    int refill(long size, void** blocks, int n);
+
+    /**
+     * Give n blocks of one size back to their owning trees, locking each tree once per run of its blocks
+     * @param size size in bytes the blocks were taken with
+     * @param blocks blocks to return, reordered by address within each run
+     * @param n number of blocks
+     */
+    void release(long size, void** blocks, int n);
+
+    /**
+     * Return the pages of every free block of at least a page to the system
+     * @return number of bytes released
+     */
+    size_t trim();
+
+    /**
+     * Merge every pair of free buddies, completing the merges the trees put off
+     * @return number of pairs merged
+     */
+    long coalesce();
+
+    /**
+     * Measure the trees' metadata against the heap they manage
+     * @return bytes of metadata per byte of heap, over every region
+     */
+    double overhead() const;
+
+    /**
+     * Take a block, preferring the calling thread's shard and falling back to the others
+     * @param size size in bytes
+     * @return pointer to the block, or null if the arena is exhausted and cannot grow
+     */
+    void* allocate(long size);
+
+    /**
+     * Give a block back to its owning tree
+     * @param pointer block to return
+     * @param size size in bytes the block was taken with
+     */
+    void deallocate(void* pointer, long size);
+
+    /**
+     * Give an allocation back without knowing its size, looking the size up from its block or mapping
+     * @param pointer allocation to return, or null
+     */
+    void deallocate(void* pointer);
+
+    /**
+     * Take an allocation aligned beyond MINIMUM, served by a block at least as large as the alignment since
+     * every block is aligned to its size. It must be given back without its size.
+     * @param size size in bytes
+     * @param align power of two alignment in bytes
+     * @return aligned allocation, or null if the arena is exhausted
+     */
+    void* aligned(long size, size_t align);
+
+    /**
+     * Determine how many bytes the allocation serving a request can actually hold
+     * @param size size in bytes
+     * @return size of the block, slab object or mapping that allocate would return
+     */
+    size_t capacity(long size) const;
+
+    /**
+     * Grow an allocation without moving it, merging a block with its free buddies or extending a mapping
+     * into the pages after it. Slab objects only grow within their class.
+     * @param pointer allocation taken with old bytes
+     * @param old size in bytes it was taken with
+     * @param size new size in bytes, to be given back with
+     * @return whether the allocation now holds size bytes, it is unchanged otherwise
+     */
+    bool try_expand(void* pointer, long old, long size);
+
+    /**
+     * Shrink an allocation without moving it, giving the blocks or pages it no longer needs back
+     * @param pointer allocation taken with old bytes
+     * @param old size in bytes it was taken with
+     * @param size new size in bytes, to be given back with
+     * @return whether the allocation now holds size bytes, false if size is served by another kind of
+     * allocation such as a slab object
+     */
+    bool shrink_in_place(void* pointer, long old, long size);
+
+    /**
+     * Resize an allocation, remapping large ones in place of a copy
+     * @param pointer allocation to resize, or null
+     * @param old size in bytes it was taken with
+     * @param size new size in bytes
+     * @return resized allocation, or null with the original left intact if the arena is exhausted
+     */
+    void* reallocate(void* pointer, long old, long size);
+
+    /**
+     * Check whether a request is served by a dedicated mapping
+     * @param size size in bytes
+     */
+    bool large(long size) const {
+        return config.large && (size_t) size >= config.large;
+    }
+
+private:
+    /**
+     * Initialize a region over a mapping and publish it to the index
+     */
+    void add(char* start, size_t len, size_t mapping);
+
+    /**
+     * Map room for a tree placed so that its heap starts on a multiple of its largest block, which aligns
+     * every block to its own size
+     * @param len bytes of the tree
+     * @param mapping set to the length of the mapping, starting at the page holding the tree
+     * @return start of the tree, or null if the mapping failed
+     */
+    static char* reserve(size_t len, size_t& mapping);
+
+    /**
+     * Map a new region large enough for a request, unless another thread already grew the arena
+     * @param size size in bytes of the request that failed
+     * @param seen number of regions when the request failed
+     * @return whether the arena holds more regions than seen
+     */
+    bool grow(long size, int seen);
+
+    /**
+     * Take up to n blocks from a single tree
+     */
+    static int drain(PearTree* tree, long size, void** blocks, int n);
+
+    /**
+     * Map and register a dedicated mapping
+     */
+    void* map(long size, size_t align = 0);
+
+    /**
+     * Unregister and unmap a dedicated mapping
+     */
+    void unmap(void* pointer);
+};
+
+#endif //WRITEQUEUECPP_ARENA_H
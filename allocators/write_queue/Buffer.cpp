@@ -0,0 +1,112 @@
+#include "Buffer.h"
+
+template<class T, class Policy>
+Buffer<T, Policy>::Buffer(const WriteQueueAllocator<T, Policy>& alloc) : alloc(alloc) {}
+
+template<class T, class Policy>
+Buffer<T, Policy>::Buffer(Buffer&& other) noexcept
+    : alloc(other.alloc), relocated(other.relocated), items(other.items), count(other.count), room(other.room) {
+    other.items = nullptr;
+    other.count = other.room = 0;
+}
+
+template<class T, class Policy>
+Buffer<T, Policy>::~Buffer() {
+    clear();
+    if (items) {
+        alloc.deallocate(items, room);
+    }
+}
+
+template<class T, class Policy>
+template<class... Args>
+T& Buffer<T, Policy>::emplace_back(Args&&... args) {
+    if (count == room) {
+        grow(count + 1);
+    }
+    T* item = new (items + count) T(std::forward<Args>(args)...);
+    count++;
+    return *item;
+}
+
+template<class T, class Policy>
+void Buffer<T, Policy>::pop_back() {
+    items[--count].~T();
+}
+
+template<class T, class Policy>
+void Buffer<T, Policy>::reserve(std::size_t n) {
+    if (n > room) {
+        grow(n);
+    }
+}
+
+template<class T, class Policy>
+void Buffer<T, Policy>::shrink_to_fit() {
+    if (count == 0 && items) {
+        alloc.deallocate(items, room);
+        items = nullptr;
+        room = 0;
+    }
+    else if (count < room && alloc.shrink_in_place(items, room, count)) {
+        room = count;
+    }
+}
+
+template<class T, class Policy>
+void Buffer<T, Policy>::clear() {
+    for (std::size_t i = 0; i < count; i++) {
+        items[i].~T();
+    }
+    count = 0;
+}
+
+template<class T, class Policy>
+void Buffer<T, Policy>::grow(std::size_t n) {
+    std::size_t wanted = std::max(n, room * 2);
+    if (items && alloc.try_expand(items, room, wanted)) {
+        room = wanted;
+        return;
+    }
+
+    if (std::is_trivially_copyable<T>::value && alloc.arena->large((long) (room * sizeof(T)))) {
+        items = alloc.reallocate(items, room, wanted);
+        room = wanted;
+        return;
+    }
+
+    //The buddy is taken, fall back to a new block and move the elements across. Blocks fresh from a split
+    //are trailing halves that cannot grow, so take a larger one and give its trailing part back.
+    //The headroom stops short of the large threshold, as blocks and mappings never shrink into one another.
+    std::size_t headroom = wanted * HEADROOM;
+    Arena& arena = *alloc.arena;
+    if (!arena.large((long) (wanted * sizeof(T))) && arena.large((long) (headroom * sizeof(T)))) {
+        headroom = (arena.config.large - 1) / sizeof(T);
+    }
+    allocation_result<T*> fresh = alloc.allocate_at_least(headroom);
+    if (alloc.shrink_in_place(fresh.ptr, fresh.count, wanted)) {
+        fresh.count = wanted;
+    }
+    std::size_t i = 0;
+    try {
+        for (; i < count; i++) {
+            new (fresh.ptr + i) T(std::move_if_noexcept(items[i]));
+        }
+    }
+    catch (...) {
+        while (i > 0) {
+            fresh.ptr[--i].~T();
+        }
+        alloc.deallocate(fresh.ptr, fresh.count);
+        throw;
+    }
+    for (i = 0; i < count; i++) {
+        items[i].~T();
+    }
+    if (items) {
+        alloc.deallocate(items, room);
+    }
+    relocated += count;
+    items = fresh.ptr;
+    room = fresh.count;
+}
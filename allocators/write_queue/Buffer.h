@@ -0,0 +1,96 @@
+#ifndef WRITEQUEUECPP_BUFFER_H
+#define WRITEQUEUECPP_BUFFER_H
+
+#include <cstddef>
+#include <utility>
+
+#include "WriteQueueAllocator.h"
+
+//Factor a relocated buffer over-allocates by before shrinking back, which leaves free the buddies it grows into
+#define HEADROOM 4
+
+/**
+ * Growable array over a WriteQueueAllocator. Growing first tries to merge the block with its free buddies
+ * in place, and only allocates a new block and moves the elements across when a buddy is taken, so
+ * append-heavy workloads copy far less than a std::vector would. Trivially copyable elements in large
+ * allocations are remapped by the kernel instead.
+ */
+template<class T, class Policy = Silent>
+struct Buffer
+{
+    typedef T value_type;
+    typedef T* iterator;
+    typedef const T* const_iterator;
+
+    WriteQueueAllocator<T, Policy> alloc;
+
+    //Elements moved to a new block because the old one could not grow in place
+    std::size_t relocated = 0;
+
+    explicit Buffer(const WriteQueueAllocator<T, Policy>& alloc);
+
+    Buffer(const Buffer&) = delete;
+
+    Buffer(Buffer&& other) noexcept;
+
+    ~Buffer();
+
+    void push_back(const T& value) { emplace_back(value); }
+
+    void push_back(T&& value) { emplace_back(std::move(value)); }
+
+    template<class... Args>
+    T& emplace_back(Args&&... args);
+
+    void pop_back();
+
+    /**
+     * Make room for at least n elements
+     * @param n number of elements
+     */
+    void reserve(std::size_t n);
+
+    /**
+     * Give back the part of the block the elements do not need, without moving them
+     */
+    void shrink_to_fit();
+
+    void clear();
+
+    std::size_t size() const { return count; }
+
+    std::size_t capacity() const { return room; }
+
+    bool empty() const { return count == 0; }
+
+    T* data() { return items; }
+
+    const T* data() const { return items; }
+
+    T& operator[](std::size_t i) { return items[i]; }
+
+    const T& operator[](std::size_t i) const { return items[i]; }
+
+    T& back() { return items[count - 1]; }
+
+    iterator begin() { return items; }
+
+    iterator end() { return items + count; }
+
+    const_iterator begin() const { return items; }
+
+    const_iterator end() const { return items + count; }
+
+private:
+    T* items = nullptr;
+    std::size_t count = 0;
+    std::size_t room = 0;
+
+    /**
+     * Grow to hold at least n elements, in place when the block's buddies are free
+     * @param n number of elements
+     */
+    void grow(std::size_t n);
+};
+
+#endif //WRITEQUEUECPP_BUFFER_H
@@ -0,0 +1,444 @@
+#ifndef WRITEQUEUECPP_FIXEDTREE_H
+#define WRITEQUEUECPP_FIXEDTREE_H
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <utility>
+
+/**
+ * Placement of the bitmaps of a FixedTree with a given number of layers, in words from the first
+ */
+template<int Layers>
+struct FixedLayout
+{
+    //Layers covered by a single word, as in peartree.c
+    static constexpr int STRIDE = 6;
+
+    static constexpr bool stored(int level, int layer) {
+        return layer % STRIDE == 0 || layer == level;
+    }
+
+    static constexpr int rise(int layer) {
+        return layer % STRIDE ? layer - layer % STRIDE : layer - STRIDE;
+    }
+
+    static constexpr long words(int layer) {
+        return ((1L << layer) + 63) / 64;
+    }
+
+    /**
+     * Offsets of every stored bitmap, by class then layer
+     */
+    static constexpr std::array<std::array<long, Layers>, Layers> offsets() {
+        std::array<std::array<long, Layers>, Layers> at{};
+        long next = 0;
+        for (int level = 0; level < Layers; level++) {
+            for (int layer = 0; layer <= level; layer++) {
+                at[level][layer] = next;
+                next += stored(level, layer) ? words(layer) : 0;
+            }
+        }
+        return at;
+    }
+
+    static constexpr long total() {
+        long sum = 0;
+        for (int level = 0; level < Layers; level++) {
+            for (int layer = 0; layer <= level; layer++) {
+                sum += stored(level, layer) ? words(layer) : 0;
+            }
+        }
+        return sum;
+    }
+};
+
+/**
+ * The PearTree engine specialized at compile time on the geometry of its heap. The layer count, the offset of
+ * every bitmap and the block size of every class are constants, and each class gets its own instantiation of
+ * the descent and the propagation up and down its tree, so their loops over layers are unrolled and their
+ * shifts and masks folded. Requests are dispatched to their class through a table built once.
+ *
+ * The bitmaps, marks and stacks are laid out as in a compact peartree.c tree, but live in the object rather
+ * than in front of the heap, and the heap is a single block of the largest class. Only taking, giving and
+ * measuring blocks are provided, and the object is not locked, see peartree.h for the full engine.
+ *
+ * @tparam HeapBytes bytes of heap, a power of two
+ * @tparam MinBlock smallest block size, a power of two able to hold a stack link
+ */
+template<size_t HeapBytes, size_t MinBlock = 16>
+struct FixedTree
+{
+    static_assert(MinBlock >= sizeof(long) && (MinBlock & (MinBlock - 1)) == 0, "bad minimum block");
+    static_assert(HeapBytes >= MinBlock && (HeapBytes & (HeapBytes - 1)) == 0, "heap must be a power of two");
+
+    //Number of classes, class zero being the whole heap
+    static constexpr int LAYERS = 64 - __builtin_clzll(HeapBytes / MinBlock);
+
+    //Minimum blocks in the heap
+    static constexpr long GRANULES = (long) (HeapBytes / MinBlock);
+
+    static_assert(LAYERS < 127, "classes must fit a mark");
+
+    /**
+     * Create a tree over a heap, all of it free
+     * @param heap memory of HeapBytes bytes, aligned to MinBlock
+     * @param zeroed whether this object was placed in memory known to be zero, such as a fresh mapping, so its
+     * bitmaps need not be cleared
+     */
+    explicit FixedTree(void* heap, bool zeroed = false) : heap((char*) heap) {
+        if (!zeroed) {
+            memset(bits, 0, sizeof(bits));
+            memset(nibbles, 0, sizeof(nibbles));
+            memset(coarse, 0, sizeof(coarse));
+        }
+        for (long& head : stack) {
+            head = -1;
+        }
+        set<0, 0>(0);
+    }
+
+    FixedTree(const FixedTree&) = delete;
+
+    /**
+     * Determine the size class that serves a request
+     * @param size size in bytes
+     * @return size class, or -1 if the request is larger than the heap
+     */
+    static int classify(size_t size) {
+        if (size > HeapBytes) {
+            return -1;
+        }
+        int rank = size <= MinBlock ? 0 : 64 - __builtin_clzll((size - 1) / MinBlock);
+        return LAYERS - 1 - rank;
+    }
+
+    /**
+     * Take a block of a given size
+     * @param size size in bytes
+     * @return pointer to the block, or null if no free block is large enough
+     */
+    void* take(size_t size) {
+        static constexpr auto table = seizers(std::make_index_sequence<LAYERS>());
+        int level = classify(size);
+        return level < 0 ? nullptr : (this->*table[level])();
+    }
+
+    /**
+     * Give a block back given the size it was taken with, skipping the lookup of its class
+     * @param pointer block taken from the tree, or null
+     * @param size size in bytes passed to take, a size no block could have been taken with being ignored
+     */
+    void give(void* pointer, size_t size) {
+        static constexpr auto table = ceders(std::make_index_sequence<LAYERS>());
+        int level = classify(size);
+        if (pointer && level >= 0) {
+            (this->*table[level])(pointer);
+        }
+    }
+
+    /**
+     * Give a block back
+     * @param pointer block taken from the tree, or null
+     */
+    void give(void* pointer) {
+        static constexpr auto table = ceders(std::make_index_sequence<LAYERS>());
+        int found = pointer ? mark(((char*) pointer - heap) / (long) MinBlock) : 0;
+        if (found > 0) {
+            (this->*table[found - 1])(pointer);
+        }
+    }
+
+    /**
+     * Determine the size of an allocated block
+     * @param pointer block taken from the tree
+     * @return size of the block in bytes, or zero if it is not allocated
+     */
+    size_t measure(void* pointer) const {
+        int found = mark(((char*) pointer - heap) / (long) MinBlock);
+        return found > 0 ? block(found - 1) : 0;
+    }
+
+private:
+    using Layout = FixedLayout<LAYERS>;
+
+    static constexpr int STRIDE = Layout::STRIDE;
+
+    //Smallest block sizes whose marks fit in a nibble
+    static constexpr int SPARSE = 7;
+
+    /**
+     * Link of a queued block to the next one down its class stack
+     */
+    struct Post
+    {
+        long next;
+    };
+
+    static constexpr size_t block(int level) {
+        return MinBlock << (LAYERS - 1 - level);
+    }
+
+    static constexpr bool stored(int level, int layer) {
+        return Layout::stored(level, layer);
+    }
+
+    static constexpr int rise(int layer) {
+        return Layout::rise(layer);
+    }
+
+    static constexpr auto OFFSETS = Layout::offsets();
+
+    char* heap;
+    long stack[LAYERS];
+    uint64_t bits[Layout::total()];
+    uint8_t nibbles[(GRANULES + 1) / 2];
+    int8_t coarse[(GRANULES >> SPARSE) + 1];
+
+    template<int Class, int Layer>
+    uint64_t& word(long index) {
+        static_assert(stored(Class, Layer), "layer is not stored");
+        return bits[OFFSETS[Class][Layer] + index / 64];
+    }
+
+    template<int Class, int Layer>
+    bool value(long index) {
+        return word<Class, Layer>(index) >> (index % 64) & 1;
+    }
+
+    template<int Class, int Layer>
+    void set(long index) {
+        word<Class, Layer>(index) |= 1ULL << (index % 64);
+    }
+
+    template<int Class, int Layer>
+    void unset(long index) {
+        word<Class, Layer>(index) &= ~(1ULL << (index % 64));
+    }
+
+    /**
+     * Values of the 1 << Span nodes Span layers below a node
+     */
+    template<int Class, int Layer, int Span>
+    uint64_t brood(long index) {
+        long first = index << Span;
+        uint64_t mask = Span == STRIDE ? ~0ULL : (1ULL << (1 << Span)) - 1;
+        return word<Class, Layer>(first) >> (first % 64) & mask;
+    }
+
+    template<int Class>
+    static constexpr long granule(long index) {
+        return index << (LAYERS - 1 - Class);
+    }
+
+    template<int Class>
+    Post* post(long index) {
+        return (Post*) (heap + index * (long) block(Class));
+    }
+
+    /**
+     * Read the mark of a minimum block, class + 1 if an allocated block starts there, ~class if a queued one does
+     */
+    int mark(long granule) const {
+        int nibble = nibbles[granule / 2] >> (granule % 2 * 4) & 15;
+        if (nibble == 15) {
+            return coarse[granule >> SPARSE];
+        }
+        if (nibble == 0) {
+            return 0;
+        }
+        int level = LAYERS - 1 - (nibble - 1) % SPARSE;
+        return nibble <= SPARSE ? level + 1 : ~level;
+    }
+
+    /**
+     * Write the mark of a minimum block, zero for a block neither allocated nor queued
+     */
+    template<int Class>
+    void stamp(long granule, int value) {
+        constexpr int rank = LAYERS - 1 - Class;
+        int nibble = 0;
+        if (value && rank < SPARSE) {
+            nibble = (value > 0 ? 1 : 1 + SPARSE) + rank;
+        }
+        else if (value) {
+            nibble = 15;
+            coarse[granule >> SPARSE] = (int8_t) value;
+        }
+        uint8_t& byte = nibbles[granule / 2];
+        int shift = granule % 2 * 4;
+        byte = (uint8_t) ((byte & ~(15 << shift)) | (nibble << shift));
+    }
+
+    template<int Class>
+    long pop() {
+        long index = stack[Class];
+        if (mark(granule<Class>(index)) != ~Class) {
+            stack[Class] = -1;
+            return -1;
+        }
+        stack[Class] = post<Class>(index)->next;
+        stamp<Class>(granule<Class>(index), 0);
+        return index;
+    }
+
+    template<int Class>
+    void push(long index) {
+        long old = stack[Class];
+        if (old >= 0 && mark(granule<Class>(old)) != ~Class) {
+            old = -1;
+        }
+        stamp<Class>(granule<Class>(index), ~Class);
+        stack[Class] = index;
+        post<Class>(index)->next = old;
+    }
+
+    /**
+     * Propagate a node becoming free up its class tree, one stored layer at a time
+     */
+    template<int Class, int Layer = Class>
+    void prograte(long index) {
+        if (value<Class, Layer>(index)) {
+            return;
+        }
+        set<Class, Layer>(index);
+        if constexpr (Layer > 0) {
+            prograte<Class, rise(Layer)>(index >> (Layer - rise(Layer)));
+        }
+    }
+
+    /**
+     * Clear the summary bits above a node that was the last free one beneath them
+     */
+    template<int Class, int Layer = Class>
+    void climb(long index) {
+        if constexpr (Layer > 0) {
+            constexpr int up = rise(Layer);
+            index >>= Layer - up;
+            if (brood<Class, Layer, Layer - up>(index)) {
+                return;
+            }
+            unset<Class, up>(index);
+            climb<Class, up>(index);
+        }
+    }
+
+    template<int Class>
+    void antigrate(long index) {
+        unset<Class, Class>(index);
+        climb<Class>(index);
+    }
+
+    template<int Class>
+    void merge(long index) {
+        unset<Class + 1, Class + 1>(index * 2 + 1);
+        antigrate<Class + 1>(index * 2);
+        prograte<Class>(index);
+    }
+
+    template<int Class>
+    void split(long index) {
+        stamp<Class>(granule<Class>(index), 0);
+        antigrate<Class>(index);
+        prograte<Class + 1>(index * 2);
+        set<Class + 1, Class + 1>(index * 2 + 1);
+    }
+
+    /**
+     * Walk down the stored layers of a class tree to a free node, leftmost first for requests and rightmost
+     * first for splits
+     */
+    template<int Class, int Layer = 0>
+    long scan(long index, bool initial) {
+        if constexpr (Layer + STRIDE <= Class) {
+            uint64_t found = word<Class, Layer + STRIDE>(index * 64);
+            return scan<Class, Layer + STRIDE>((index << STRIDE) + pick(found, initial), initial);
+        }
+        else if constexpr (Layer < Class) {
+            constexpr int rest = Class - Layer;
+            long first = index << rest;
+            uint64_t found = word<Class, Class>(first) >> (first % 64) & ((1ULL << (1 << rest)) - 1);
+            return first + pick(found, initial);
+        }
+        else {
+            return index;
+        }
+    }
+
+    static int pick(uint64_t word, bool leftmost) {
+        return leftmost ? __builtin_ctzll(word) : 63 - __builtin_clzll(word);
+    }
+
+    template<int Class>
+    long descend(bool initial) {
+        if (stack[Class] >= 0) {
+            long index = pop<Class>();
+            if (index >= 0) {
+                return index;
+            }
+        }
+        if (!bits[OFFSETS[Class][0]]) {
+            if constexpr (Class == 0) {
+                return -1;
+            }
+            else {
+                long parent = descend<Class - 1>(false);
+                if (parent < 0) {
+                    return -1;
+                }
+                split<Class - 1>(parent);
+                return parent * 2 + 1;
+            }
+        }
+        return scan<Class>(0, initial);
+    }
+
+    template<int Class>
+    void ascend(long index, bool initial) {
+        if constexpr (Class > 0) {
+            long parent = index / 2;
+            if ((word<Class, Class>(parent * 2) >> (parent * 2 % 64) & 3) == 3) {
+                stamp<Class>(granule<Class>(parent * 2), 0);
+                stamp<Class>(granule<Class>(parent * 2 + 1), 0);
+                merge<Class - 1>(parent);
+                ascend<Class - 1>(parent, false);
+                return;
+            }
+        }
+        if (initial) {
+            push<Class>(index);
+        }
+    }
+
+    template<int Class>
+    void* seize() {
+        long index = descend<Class>(true);
+        if (index < 0) {
+            return nullptr;
+        }
+        antigrate<Class>(index);
+        stamp<Class>(granule<Class>(index), Class + 1);
+        return heap + index * (long) block(Class);
+    }
+
+    template<int Class>
+    void cede(void* pointer) {
+        long index = ((char*) pointer - heap) / (long) block(Class);
+        stamp<Class>(granule<Class>(index), 0);
+        prograte<Class>(index);
+        ascend<Class>(index, true);
+    }
+
+    template<size_t... Class>
+    static constexpr std::array<void* (FixedTree::*)(), LAYERS> seizers(std::index_sequence<Class...>) {
+        return {{&FixedTree::seize<(int) Class>...}};
+    }
+
+    template<size_t... Class>
+    static constexpr std::array<void (FixedTree::*)(void*), LAYERS> ceders(std::index_sequence<Class...>) {
+        return {{&FixedTree::cede<(int) Class>...}};
+    }
+};
+
+#endif //WRITEQUEUECPP_FIXEDTREE_H
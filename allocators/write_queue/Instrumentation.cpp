@@ -0,0 +1,40 @@
+#include "Instrumentation.h"
+
+long Counting::reserved(size_t bytes) const {
+    const Arena* arena = counters->arena;
+    return arena ? (long) arena->capacity((long) bytes) : (long) bytes;
+}
+
+void Counting::allocated(void*, size_t bytes) {
+    int r = Arena::rank((long) bytes);
+    counters->allocations[r].fetch_add(1, std::memory_order_relaxed);
+    counters->reserved.fetch_add(reserved(bytes), std::memory_order_relaxed);
+    long live = counters->live.fetch_add((long) bytes, std::memory_order_relaxed) + (long) bytes;
+    long peak = counters->peak.load(std::memory_order_relaxed);
+    while (live > peak && !counters->peak.compare_exchange_weak(peak, live, std::memory_order_relaxed));
+}
+
+void Counting::deallocated(void*, size_t bytes) {
+    int r = Arena::rank((long) bytes);
+    counters->deallocations[r].fetch_add(1, std::memory_order_relaxed);
+    counters->reserved.fetch_sub(reserved(bytes), std::memory_order_relaxed);
+    counters->live.fetch_sub((long) bytes, std::memory_order_relaxed);
+}
+
+void Counting::failed(size_t) {
+    counters->failures.fetch_add(1, std::memory_order_relaxed);
+}
+
+Stats Counting::stats() const {
+    Stats stats{};
+    for (int r = 0; r < RANKS; r++) {
+        stats.allocations[r] = counters->allocations[r].load(std::memory_order_relaxed);
+        stats.deallocations[r] = counters->deallocations[r].load(std::memory_order_relaxed);
+    }
+    stats.live = counters->live.load(std::memory_order_relaxed);
+    stats.peak = counters->peak.load(std::memory_order_relaxed);
+    stats.reserved = counters->reserved.load(std::memory_order_relaxed);
+    stats.failures = counters->failures.load(std::memory_order_relaxed);
+    stats.fragmentation = stats.reserved > 0 ? 1 - (double) stats.live / (double) stats.reserved : 0;
+    return stats;
+}
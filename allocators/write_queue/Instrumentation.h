@@ -0,0 +1,113 @@
+#ifndef WRITEQUEUECPP_INSTRUMENTATION_H
+#define WRITEQUEUECPP_INSTRUMENTATION_H
+
+#include <atomic>
+#include <cstddef>
+#include <iostream>
+#include <memory>
+
+#include "Arena.h"
+
+//Number of size classes tracked by rank, enough for any 64-bit request
+#define RANKS 64
+
+/**
+ * Snapshot of an allocator's counters
+ */
+struct Stats
+{
+    //Calls served per size class, indexed by rank (class MINIMUM << rank)
+    long allocations[RANKS];
+    long deallocations[RANKS];
+
+    //Bytes requested by live allocations, and the most ever live at once
+    long live;
+    long peak;
+
+    //Bytes of the blocks, slab objects and mappings backing live allocations
+    long reserved;
+
+    //Requests the arena could not satisfy
+    long failures;
+
+    //Share of reserved bytes lost to rounding up to a block or slab class
+    double fragmentation;
+};
+
+/**
+ * Default policy, every hook is empty and compiles away
+ */
+struct Silent
+{
+    void attach(const Arena&) {}
+    void allocated(void*, size_t) {}
+    void deallocated(void*, size_t) {}
+    void failed(size_t) {}
+};
+
+/**
+ * Policy printing every call, as the allocator used to
+ */
+struct Logging
+{
+    void attach(const Arena&) {}
+
+    void allocated(void* p, size_t bytes) {
+        std::cout << "[write_queue] allocated " << bytes << " bytes at " << p << '\n';
+    }
+
+    void deallocated(void* p, size_t bytes) {
+        std::cout << "[write_queue] freed " << bytes << " bytes at " << p << '\n';
+    }
+
+    void failed(size_t bytes) {
+        std::cout << "[write_queue] failed to allocate " << bytes << " bytes" << '\n';
+    }
+};
+
+/**
+ * Policy keeping relaxed atomic counters, shared by every copy of the allocator
+ */
+struct Counting
+{
+    struct Counters
+    {
+        std::atomic<long> allocations[RANKS];
+        std::atomic<long> deallocations[RANKS];
+        std::atomic<long> live;
+        std::atomic<long> peak;
+        std::atomic<long> reserved;
+        std::atomic<long> failures;
+
+        //Arena whose rounding reserved bytes are counted with
+        const Arena* arena;
+    };
+
+    std::shared_ptr<Counters> counters = std::make_shared<Counters>();
+
+    /**
+     * Count reserved bytes as the allocator's arena rounds them, with or without slabs and large mappings
+     * @param arena arena of the allocator owning the policy
+     */
+    void attach(const Arena& arena) { counters->arena = &arena; }
+
+    void allocated(void* p, size_t bytes);
+
+    void deallocated(void* p, size_t bytes);
+
+    void failed(size_t bytes);
+
+    /**
+     * Read the counters
+     * @return snapshot, individually consistent but not atomic as a whole
+     */
+    Stats stats() const;
+
+private:
+    /**
+     * Count the bytes of the block, slab object or mapping serving a request
+     */
+    long reserved(size_t bytes) const;
+};
+
+#endif //WRITEQUEUECPP_INSTRUMENTATION_H
@@ -0,0 +1,148 @@
+#include "Persistent.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Identifies a persistent heap file
+#define MAGIC "PEARHEAP"
+
+Persistent::Persistent(const char* path, size_t size) {
+    fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+
+    //A second writer would corrupt the tree, the lock is released when the descriptor closes
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    struct stat info{};
+    fstat(fd, &info);
+    bool fresh = info.st_size == 0;
+    if (fresh) {
+        //The file is extended sparsely and reads as zero, so the tree need not clear its metadata
+        size = (size + page - 1) / page * page;
+        if (ftruncate(fd, (off_t) (page + size)) != 0) {
+            int error = errno;
+            close(fd);
+            throw std::system_error(error, std::generic_category(), path);
+        }
+        mapping = page + size;
+    }
+    else if ((size_t) info.st_size <= page) {
+        close(fd);
+        throw std::runtime_error("not a persistent heap of this layout");
+    }
+    else {
+        mapping = (size_t) info.st_size;
+    }
+
+    void* start = mmap(nullptr, mapping, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (start == MAP_FAILED) {
+        int error = errno;
+        close(fd);
+        throw std::system_error(error, std::generic_category(), path);
+    }
+    super = (Superblock*) start;
+    char* heap = (char*) start + page;
+
+    if (fresh) {
+        memcpy(super->magic, MAGIC, sizeof(super->magic));
+        super->version = PERSISTENT_VERSION;
+        super->minimum = MINIMUM;
+        super->compact = COMPACT;
+        super->len = mapping - page;
+        super->root = 0;
+        adopt(&tree, heap, (long) super->len);
+        sync();
+        return;
+    }
+
+    //Refuse files written by another layout, the tree would read its state at the wrong offsets
+    if (memcmp(super->magic, MAGIC, sizeof(super->magic)) != 0
+        || super->version != PERSISTENT_VERSION || super->minimum != MINIMUM || super->compact != COMPACT
+        || super->len != mapping - page) {
+        munmap(start, mapping);
+        close(fd);
+        throw std::runtime_error("not a persistent heap of this layout");
+    }
+
+    reopen(&tree, heap, (long) super->len);
+    if (!super->clean) {
+        recovered = true;
+        if (!verify(&tree)) {
+            munmap(start, mapping);
+            close(fd);
+            throw std::runtime_error("persistent heap failed verification");
+        }
+    }
+}
+
+Persistent::~Persistent() {
+    sync();
+    munmap(super, mapping);
+    close(fd);
+}
+
+void Persistent::dirty() {
+    //Only reach the disk on the first change after a sync, so a crash never leaves a changed heap marked clean
+    if (super->clean) {
+        super->clean = 0;
+        msync(super, sizeof(Superblock), MS_SYNC);
+    }
+}
+
+void* Persistent::allocate(long size) {
+    lock(&tree);
+    dirty();
+    void* p = take(&tree, size);
+    unlock(&tree);
+    return p;
+}
+
+void Persistent::deallocate(void* pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    lock(&tree);
+    dirty();
+    give(&tree, pointer);
+    unlock(&tree);
+}
+
+void Persistent::deallocate(void* pointer, long size) {
+    if (pointer == nullptr) {
+        return;
+    }
+    lock(&tree);
+    dirty();
+    give_sized(&tree, pointer, size);
+    unlock(&tree);
+}
+
+void Persistent::root(void* pointer) {
+    lock(&tree);
+    dirty();
+    super->root = offset(pointer);
+    unlock(&tree);
+}
+
+void Persistent::sync() {
+    //Hold the lock so the pages written never show an operation half done
+    lock(&tree);
+    msync(super, mapping, MS_SYNC);
+    super->clean = 1;
+    msync(super, sizeof(Superblock), MS_SYNC);
+    unlock(&tree);
+}
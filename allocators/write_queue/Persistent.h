@@ -0,0 +1,135 @@
+#ifndef WRITEQUEUECPP_PERSISTENT_H
+#define WRITEQUEUECPP_PERSISTENT_H
+
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+    #include "peartree.h"
+}
+
+//Layout version of persistent heap files, bumped whenever the tree's state region changes shape
+#define PERSISTENT_VERSION 3
+
+/**
+ * A PearTree kept in a file. The tree stores its free lists as indices and rebuilds its few absolute
+ * pointers on open, so an existing heap is reopened in constant time at whatever address it is mapped,
+ * and its pages are only read from the file as they are touched. Objects in the heap must refer to each
+ * other by offset, see offset() and at().
+ *
+ * The file is consistent once sync() or the destructor returns, blocks' contents included. The header
+ * records whether the tree changed since, and opening a heap that was not synced after its last change,
+ * such as after a crash, verifies the whole tree before trusting it.
+ */
+struct Persistent
+{
+    /**
+     * Header in the first page of the file
+     */
+    struct Superblock
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t minimum;
+        uint32_t compact;
+
+        //Whether the heap is unchanged since it was last synced
+        uint32_t clean;
+
+        //Bytes of the tree following the header page
+        uint64_t len;
+
+        //Offset of the application's root object, zero for none
+        uint64_t root;
+    };
+
+    Superblock* super = nullptr;
+    PearTree tree{};
+    size_t mapping = 0;
+    int fd = -1;
+
+    //Whether opening found the heap modified since its last sync and had to verify it
+    bool recovered = false;
+
+    /**
+     * Open the heap in a file, creating it if the file is empty or missing. Only one process may hold a
+     * heap open at a time.
+     * @param path file holding the heap
+     * @param size bytes of heap to create, ignored when the file already holds one
+     * @throws std::system_error if the file cannot be opened, locked or mapped
+     * @throws std::runtime_error if the file does not hold a heap of this layout, or it fails verification
+     */
+    Persistent(const char* path, size_t size);
+
+    Persistent(const Persistent&) = delete;
+
+    /**
+     * Sync the heap, mark it clean and unmap it
+     */
+    ~Persistent();
+
+    /**
+     * Take a block
+     * @param size size in bytes
+     * @return pointer to the block, or null if the heap is exhausted
+     */
+    void* allocate(long size);
+
+    /**
+     * Give a block back
+     * @param pointer block to return, or null
+     */
+    void deallocate(void* pointer);
+
+    /**
+     * Give a block back given the size it was taken with
+     * @param pointer block to return, or null
+     * @param size size in bytes
+     */
+    void deallocate(void* pointer, long size);
+
+    /**
+     * Write every dirty page to the file and mark the heap clean, a consistency point that survives a crash
+     */
+    void sync();
+
+    /**
+     * Translate a pointer into the heap to a position independent offset
+     * @param pointer pointer into the heap, or null
+     * @return offset from the start of the file, zero for null
+     */
+    uint64_t offset(const void* pointer) const {
+        return pointer ? (uint64_t) ((const char*) pointer - (const char*) super) : 0;
+    }
+
+    /**
+     * Translate an offset back to a pointer in the current mapping
+     * @param offset offset from the start of the file, or zero
+     * @return pointer into the heap, null for zero
+     */
+    void* at(uint64_t offset) const {
+        return offset ? (char*) super + offset : nullptr;
+    }
+
+    /**
+     * Find the application's root object, the entry point to everything else kept in the heap
+     * @return root object, or null if none was set
+     */
+    void* root() const {
+        return at(super->root);
+    }
+
+    /**
+     * Set the application's root object
+     * @param pointer block taken from the heap, or null
+     */
+    void root(void* pointer);
+
+private:
+    /**
+     * Record on disk that the heap is about to change, before the first change after a sync
+     */
+    void dirty();
+};
+
+#endif //WRITEQUEUECPP_PERSISTENT_H
@@ -0,0 +1,291 @@
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <pthread.h>
+#include <unistd.h>
+
+#include "Arena.h"
+#include "ThreadCache.h"
+
+/**
+ * Drop-in replacement for the C and C++ heap, loaded with LD_PRELOAD. Every entry point is served by a
+ * single process-wide arena, so whole binaries can be measured against glibc without recompiling them.
+ * The arena is configured through the environment:
+ *  PEARTREE_HEAP   bytes per shard of the initial mapping, 256 MiB by default
+ *  PEARTREE_SHARDS number of shards, 1 by default
+ *  PEARTREE_PURGE  bytes freed before free pages are trimmed, 0 to never trim
+ */
+
+#define EXPORT extern "C"
+
+namespace {
+    alignas(Arena) char storage[sizeof(Arena)];
+
+    long setting(const char* name, long fallback) {
+        const char* value = getenv(name);
+        return value && *value ? strtol(value, nullptr, 0) : fallback;
+    }
+
+    /**
+     * Construct the arena in static storage on first use. It is never destroyed, since other libraries'
+     * destructors keep freeing memory after ours would have run.
+     */
+    Arena* start() {
+        Config config;
+        config.shards = (int) setting("PEARTREE_SHARDS", 1);
+        config.growable = true;
+        config.purge = (size_t) setting("PEARTREE_PURGE", 0);
+        return new (storage) Arena((size_t) setting("PEARTREE_HEAP", 256L << 20), config);
+    }
+
+    Arena* heap() {
+        static Arena* arena = start();
+        return arena;
+    }
+
+    //Hold every lock across fork so the child never inherits one taken by a thread that no longer exists. They are
+    //taken in the order the allocator nests them: exiting threads flush under the lifetimes lock, slab classes stay
+    //locked while refilling from the trees, and growth and mappings are locked before any tree.
+    void prepare() {
+        Arena* arena = heap();
+        ThreadCache::freeze();
+        for (auto& slabs : arena->slabs) {
+            slabs.mutex.lock();
+        }
+        arena->growing.lock();
+        arena->mappings.mutex.lock();
+        for (int i = 0; i < arena->count.load(std::memory_order_acquire); i++) {
+            lock(&arena->regions[i].tree);
+        }
+    }
+
+    void resume() {
+        Arena* arena = heap();
+        for (int i = arena->count.load(std::memory_order_acquire) - 1; i >= 0; i--) {
+            unlock(&arena->regions[i].tree);
+        }
+        arena->mappings.mutex.unlock();
+        arena->growing.unlock();
+        for (int s = SLABBED / GRAIN; s >= 0; s--) {
+            arena->slabs[s].mutex.unlock();
+        }
+        ThreadCache::thaw();
+    }
+
+    __attribute__((constructor)) void attach() {
+        heap();
+        pthread_atfork(prepare, resume, resume);
+    }
+
+    void* allocate(size_t size, size_t align = 0) {
+        if ((long) size < 0) {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        //A zero byte request still needs a unique pointer
+        long bytes = size ? (long) size : 1;
+        void* p = align ? heap()->aligned(bytes, align) : heap()->allocate(bytes);
+        if (p == nullptr) {
+            errno = ENOMEM;
+        }
+        return p;
+    }
+
+    /**
+     * Allocate for operator new, running the new handler until it succeeds or gives up
+     */
+    void* renew(size_t size, size_t align = 0) {
+        for (;;) {
+            if (void* p = allocate(size, align)) {
+                return p;
+            }
+            std::new_handler handler = std::get_new_handler();
+            if (handler == nullptr) {
+                throw std::bad_alloc();
+            }
+            handler();
+        }
+    }
+
+    bool power(size_t align) {
+        return align && (align & (align - 1)) == 0;
+    }
+}
+
+EXPORT void* malloc(size_t size) {
+    return allocate(size);
+}
+
+EXPORT void free(void* p) {
+    heap()->deallocate(p);
+}
+
+EXPORT void* calloc(size_t count, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    void* p = allocate(bytes);
+
+    //Fresh mappings are already zero, blocks may have been used before
+    if (p && !heap()->large((long) bytes)) {
+        memset(p, 0, bytes);
+    }
+    return p;
+}
+
+EXPORT void* realloc(void* p, size_t size) {
+    if (p == nullptr) {
+        return allocate(size);
+    }
+    if (size == 0) {
+        free(p);
+        return nullptr;
+    }
+
+    Arena* arena = heap();
+    size_t old = arena->usable(p);
+    bool block = arena->within(p) != nullptr;
+
+    //Keep a block that still fits the request without wasting more than half of it
+    if (block && size <= old && (size > old / 2 || old == MINIMUM)) {
+        return p;
+    }
+
+    //Let the kernel move a large mapping rather than copying it
+    if (!block && arena->large((long) old) && arena->large((long) size)) {
+        void* q = arena->reallocate(p, (long) old, (long) size);
+        if (q == nullptr) {
+            errno = ENOMEM;
+        }
+        return q;
+    }
+
+    void* q = allocate(size);
+    if (q) {
+        memcpy(q, p, old < size ? old : size);
+        arena->deallocate(p);
+    }
+    return q;
+}
+
+EXPORT void* reallocarray(void* p, size_t count, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(count, size, &bytes)) {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(p, bytes);
+}
+
+EXPORT int posix_memalign(void** out, size_t align, size_t size) {
+    if (!power(align) || align % sizeof(void*)) {
+        return EINVAL;
+    }
+    void* p = allocate(size, align);
+    if (p == nullptr) {
+        return ENOMEM;
+    }
+    *out = p;
+    return 0;
+}
+
+EXPORT void* aligned_alloc(size_t align, size_t size) {
+    if (!power(align)) {
+        errno = EINVAL;
+        return nullptr;
+    }
+    return allocate(size, align);
+}
+
+EXPORT void* memalign(size_t align, size_t size) {
+    return aligned_alloc(align, size);
+}
+
+EXPORT void* valloc(size_t size) {
+    return allocate(size, (size_t) sysconf(_SC_PAGESIZE));
+}
+
+EXPORT void* pvalloc(size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    return allocate((size + page - 1) / page * page, page);
+}
+
+EXPORT size_t malloc_usable_size(void* p) {
+    return p ? heap()->usable(p) : 0;
+}
+
+void* operator new(size_t size) {
+    return renew(size);
+}
+
+void* operator new[](size_t size) {
+    return renew(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept {
+    return allocate(size);
+}
+
+void* operator new(size_t size, std::align_val_t align) {
+    return renew(size, (size_t) align);
+}
+
+void* operator new[](size_t size, std::align_val_t align) {
+    return renew(size, (size_t) align);
+}
+
+void* operator new(size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocate(size, (size_t) align);
+}
+
+void* operator new[](size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+    return allocate(size, (size_t) align);
+}
+
+void operator delete(void* p) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete[](void* p) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete[](void* p, size_t) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete[](void* p, const std::nothrow_t&) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete(void* p, size_t, std::align_val_t) noexcept {
+    heap()->deallocate(p);
+}
+
+void operator delete[](void* p, size_t, std::align_val_t) noexcept {
+    heap()->deallocate(p);
+}
@@ -0,0 +1,391 @@
+#include "Profile.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <cxxabi.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//Profiles that can be dumping on a signal at once
+#define WATCHERS 16
+
+//Marks the slot of a removed sample while later slots of its run are in use
+#define GONE ((uintptr_t) 1)
+
+namespace {
+    //Write ends of the pipes of profiles dumping on a signal, and the signal each dumps on, zero if none
+    std::atomic<int> watchers[WATCHERS];
+    std::atomic<int> signals[WATCHERS];
+    std::mutex registry;
+
+    //Handler each signal had before the first profile dumped on it, copied to every slot dumping on it
+    struct sigaction saved[WATCHERS];
+
+    //Whether the calling thread drew its first countdown, and the state it draws them from
+    thread_local bool primed = false;
+    thread_local uint64_t state = 0;
+
+    /**
+     * Wake the watchers of a signal, the only part of dumping done in the handler
+     */
+    void wake(int signal) {
+        int saved = errno;
+        for (int i = 0; i < WATCHERS; i++) {
+            if (signals[i].load(std::memory_order_acquire) == signal) {
+                char c = 'd';
+                if (write(watchers[i].load(std::memory_order_relaxed), &c, 1) < 0) {
+                    //A full pipe has a dump pending already
+                }
+            }
+        }
+        errno = saved;
+    }
+
+    /**
+     * Draw the bytes until the next sample, exponentially distributed so samples form a Poisson process
+     * @param rate mean of the distribution
+     */
+    long draw(long rate) {
+        if (state == 0) {
+            state = ((uint64_t) (uintptr_t) &state
+                     ^ (uint64_t) std::chrono::steady_clock::now().time_since_epoch().count()) | 1;
+        }
+        state ^= state >> 12;
+        state ^= state << 25;
+        state ^= state >> 27;
+        double u = (double) (((state * 0x2545F4914F6CDD1DULL) >> 11) + 1) * 0x1.0p-53;
+        return std::max(1L, (long) (-std::log(u) * (double) rate));
+    }
+
+    /**
+     * Slot a sample's run of the table starts at
+     */
+    size_t home(const void* p) {
+        return (size_t) (((uint64_t) (uintptr_t) p >> 4) * 0x9E3779B97F4A7C15ULL >> 32) & (SAMPLED - 1);
+    }
+
+    /**
+     * Allocations a sample of a size stands for, the inverse of the chance of sampling one
+     */
+    double weight(size_t bytes, long rate) {
+        return 1 / -std::expm1(-(double) bytes / (double) rate);
+    }
+
+    /**
+     * Write the name of the function a return address is in, or its module and offset if it has none
+     */
+    void symbol(FILE* out, uintptr_t frame) {
+        Dl_info info{};
+        if (dladdr((void*) (frame - 1), &info) == 0 || info.dli_fname == nullptr) {
+            fprintf(out, "0x%lx", (unsigned long) frame);
+            return;
+        }
+        if (info.dli_sname == nullptr) {
+            const char* name = strrchr(info.dli_fname, '/');
+            fprintf(out, "%s+0x%lx", name ? name + 1 : info.dli_fname,
+                    (unsigned long) (frame - (uintptr_t) info.dli_fbase));
+            return;
+        }
+        int status = 0;
+        char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+        fputs(status == 0 ? demangled : info.dli_sname, out);
+        free(demangled);
+    }
+}
+
+Profile::Profile(long rate) : interval(rate), slots(new std::atomic<uintptr_t>[SAMPLED]()),
+                              entries(new Entry[SAMPLED]), hashed(new uint16_t[FILTER]()) {
+    //The unwinder loads on its first use, which allocates, so load it now rather than under the lock
+    void* frame;
+    backtrace(&frame, 1);
+}
+
+Profile::~Profile() {
+    if (watcher < 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> guard(registry);
+        int signal = signals[watcher].load(std::memory_order_relaxed);
+        signals[watcher].store(0, std::memory_order_release);
+        bool shared = false;
+        for (int i = 0; i < WATCHERS; i++) {
+            shared |= signals[i].load(std::memory_order_relaxed) == signal;
+        }
+        //The last profile dumping on a signal hands it back to its previous handler
+        if (!shared) {
+            sigaction(signal, &saved[watcher], nullptr);
+        }
+    }
+    char c = 'q';
+    while (write(ends[1], &c, 1) < 0 && errno == EINTR);
+    thread.join();
+    close(ends[0]);
+    close(ends[1]);
+    dump(target.c_str(), format);
+}
+
+void Profile::sample(void* p, size_t bytes) {
+    //A thread's countdown starts out at zero, as the rate is the profile's. Its first allocation draws the countdown
+    //the thread would have started with and is sampled only if it runs that out too.
+    if (!primed) {
+        primed = true;
+        sampling::countdown = draw(interval) - (long) bytes;
+        if (sampling::countdown >= 0) {
+            return;
+        }
+    }
+    sampling::countdown = draw(interval);
+
+    uintptr_t frames[FRAMES + 1];
+    int depth = std::max(0, backtrace((void**) frames, FRAMES + 1) - 1);
+
+    std::lock_guard<std::mutex> guard(mutex);
+    if (live.load(std::memory_order_relaxed) >= SAMPLED / 2) {
+        return;
+    }
+    uint32_t s = site(frames + 1, depth);
+    Site& at = sites[s];
+    at.live++;
+    at.live_bytes += (long) bytes;
+    at.total++;
+    at.total_bytes += (long) bytes;
+    at.estimate += (double) bytes * weight(bytes, interval);
+
+    size_t i = home(p);
+    while (slots[i].load(std::memory_order_relaxed) > GONE) {
+        i = (i + 1) & (SAMPLED - 1);
+    }
+    entries[i] = {bytes, s};
+    if (hashed[bit(p)]++ == 0) {
+        filter[bit(p) / 64].fetch_or(1ULL << bit(p) % 64, std::memory_order_relaxed);
+    }
+    slots[i].store((uintptr_t) p, std::memory_order_release);
+    live.fetch_add(1, std::memory_order_relaxed);
+}
+
+bool Profile::holds(void* p) const {
+    size_t i = home(p);
+    for (long probes = 0; probes < SAMPLED; probes++) {
+        uintptr_t slot = slots[i].load(std::memory_order_acquire);
+        if (slot == (uintptr_t) p) {
+            return true;
+        }
+        if (slot == 0) {
+            return false;
+        }
+        i = (i + 1) & (SAMPLED - 1);
+    }
+    return false;
+}
+
+void Profile::remove(void* p) {
+    std::lock_guard<std::mutex> guard(mutex);
+    size_t i = home(p);
+    for (long probes = 0; slots[i].load(std::memory_order_relaxed) != (uintptr_t) p; probes++) {
+        if (probes == SAMPLED || slots[i].load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        i = (i + 1) & (SAMPLED - 1);
+    }
+    Entry entry = entries[i];
+    Site& at = sites[entry.site];
+    at.live--;
+    at.live_bytes -= (long) entry.bytes;
+    at.estimate -= (double) entry.bytes * weight(entry.bytes, interval);
+    live.fetch_sub(1, std::memory_order_relaxed);
+    if (--hashed[bit(p)] == 0) {
+        filter[bit(p) / 64].fetch_and(~(1ULL << bit(p) % 64), std::memory_order_relaxed);
+    }
+
+    //No run reaches past an empty slot, so a slot followed by one and the tombstones before it can be emptied
+    if (slots[(i + 1) & (SAMPLED - 1)].load(std::memory_order_relaxed) != 0) {
+        slots[i].store(GONE, std::memory_order_relaxed);
+        return;
+    }
+    for (long probes = 0; probes < SAMPLED; probes++) {
+        slots[i].store(0, std::memory_order_relaxed);
+        i = (i - 1) & (SAMPLED - 1);
+        if (slots[i].load(std::memory_order_relaxed) != GONE) {
+            break;
+        }
+    }
+}
+
+uint32_t Profile::site(const uintptr_t* frames, int depth) {
+    uint64_t hash = (uint64_t) depth;
+    for (int d = 0; d < depth; d++) {
+        hash = (hash ^ frames[d]) * 0x100000001B3ULL;
+    }
+    auto range = index.equal_range(hash);
+    for (auto it = range.first; it != range.second; ++it) {
+        const Site& known = sites[it->second];
+        if (known.depth == depth && memcmp(known.frames, frames, sizeof(*frames) * (size_t) depth) == 0) {
+            return it->second;
+        }
+    }
+    Site fresh{};
+    memcpy(fresh.frames, frames, sizeof(*frames) * (size_t) depth);
+    fresh.depth = depth;
+    fresh.hash = hash;
+    sites.push_back(fresh);
+    index.emplace(hash, (uint32_t) (sites.size() - 1));
+    return (uint32_t) (sites.size() - 1);
+}
+
+void Profile::dump(FILE* out, Format layout) const {
+    //Symbolizing is slow, so write from a copy rather than holding up sampling threads
+    std::vector<Site> copy;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        copy = sites;
+    }
+
+    if (layout == Folded) {
+        for (const Site& at : copy) {
+            if (at.live == 0) {
+                continue;
+            }
+            for (int d = at.depth - 1; d >= 0; d--) {
+                symbol(out, at.frames[d]);
+                fputc(d > 0 ? ';' : ' ', out);
+            }
+            fprintf(out, "%ld\n", std::lround(at.estimate));
+        }
+        return;
+    }
+
+    //pprof scales the sampled counts of a heap_v2 profile back up by the rate itself
+    long live = 0, live_bytes = 0, total = 0, total_bytes = 0;
+    for (const Site& at : copy) {
+        live += at.live;
+        live_bytes += at.live_bytes;
+        total += at.total;
+        total_bytes += at.total_bytes;
+    }
+    fprintf(out, "heap profile: %ld: %ld [%ld: %ld] @ heap_v2/%ld\n", live, live_bytes, total, total_bytes,
+            interval);
+    for (const Site& at : copy) {
+        fprintf(out, "%ld: %ld [%ld: %ld] @", at.live, at.live_bytes, at.total, at.total_bytes);
+        for (int d = 0; d < at.depth; d++) {
+            fprintf(out, " 0x%lx", (unsigned long) at.frames[d]);
+        }
+        fputc('\n', out);
+    }
+
+    //Lets pprof map the addresses to the binary and libraries they were loaded from
+    fputs("\nMAPPED_LIBRARIES:\n", out);
+    if (FILE* maps = fopen("/proc/self/maps", "r")) {
+        char buffer[4096];
+        for (size_t n; (n = fread(buffer, 1, sizeof(buffer), maps)) > 0;) {
+            fwrite(buffer, 1, n, out);
+        }
+        fclose(maps);
+    }
+}
+
+bool Profile::dump(const char* path, Format layout) const {
+    FILE* out = fopen(path, "w");
+    if (out == nullptr) {
+        return false;
+    }
+    dump(out, layout);
+    return fclose(out) == 0;
+}
+
+void Profile::dump_on(int signal, const char* path, Format layout) {
+    if (pipe2(ends, O_CLOEXEC | O_NONBLOCK) != 0) {
+        throw std::system_error(errno, std::generic_category(), "pipe2");
+    }
+    //Only the handler's end may not block, the watcher waits on its own
+    fcntl(ends[0], F_SETFL, 0);
+    target = path;
+    format = layout;
+    {
+        std::lock_guard<std::mutex> guard(registry);
+        for (int i = 0; i < WATCHERS && watcher < 0; i++) {
+            if (signals[i].load(std::memory_order_relaxed) == 0) {
+                watcher = i;
+            }
+        }
+        if (watcher < 0) {
+            close(ends[0]);
+            close(ends[1]);
+            throw std::runtime_error("too many profiles dump on signals");
+        }
+
+        //Only the first profile dumping on a signal installs the handler, the others share what it replaced
+        int sharing = -1;
+        for (int i = 0; i < WATCHERS; i++) {
+            if (signals[i].load(std::memory_order_relaxed) == signal) {
+                sharing = i;
+            }
+        }
+        if (sharing >= 0) {
+            saved[watcher] = saved[sharing];
+        }
+        else {
+            struct sigaction action{};
+            action.sa_handler = wake;
+            action.sa_flags = SA_RESTART;
+            sigemptyset(&action.sa_mask);
+            if (sigaction(signal, &action, &saved[watcher]) != 0) {
+                int error = errno;
+                close(ends[0]);
+                close(ends[1]);
+                watcher = -1;
+                throw std::system_error(error, std::generic_category(), "sigaction");
+            }
+        }
+        watchers[watcher].store(ends[1], std::memory_order_relaxed);
+        signals[watcher].store(signal, std::memory_order_release);
+    }
+
+    thread = std::thread([this] {
+        int dumps = 0;
+        char c;
+        for (;;) {
+            ssize_t n = read(ends[0], &c, 1);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0 || c == 'q') {
+                return;
+            }
+            dump((target + "." + std::to_string(++dumps)).c_str(), format);
+        }
+    });
+}
+
+long Profile::estimate() const {
+    std::lock_guard<std::mutex> guard(mutex);
+    double total = 0;
+    for (const Site& at : sites) {
+        total += at.estimate;
+    }
+    return std::lround(total);
+}
+
+Sampling::Sampling() {
+    //Every allocator sampling into the environment's profile shares it, so it is dumped as one
+    static std::shared_ptr<Profile> shared = [] {
+        const char* path = getenv("PEARTREE_PROFILE");
+        if (path == nullptr || *path == 0) {
+            return std::shared_ptr<Profile>();
+        }
+        const char* rate = getenv("PEARTREE_PROFILE_RATE");
+        long interval = rate && *rate ? atol(rate) : SAMPLE_RATE;
+        auto profile = std::make_shared<Profile>(interval > 0 ? interval : SAMPLE_RATE);
+        profile->dump_on(PROFILE_SIGNAL, path, Pprof);
+        return profile;
+    }();
+    profile = shared;
+}
@@ -0,0 +1,248 @@
+#ifndef WRITEQUEUECPP_PROFILE_H
+#define WRITEQUEUECPP_PROFILE_H
+
+#include <atomic>
+#include <csignal>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+struct Arena;
+
+//Bytes allocated between samples on average, as tcmalloc samples by default. Each sample unwinds the stack.
+#define SAMPLE_RATE (2L << 20)
+
+//Slots of the table of live sampled allocations, a power of two. Samples beyond half of it are left out.
+#define SAMPLED (1 << 16)
+
+//Bits of the filter deallocations check before probing the table, small enough to stay cached
+#define FILTER 4096
+
+//Frames of the call stack kept per sample
+#define FRAMES 32
+
+//Signal the profile named by PEARTREE_PROFILE is dumped on
+#define PROFILE_SIGNAL SIGUSR2
+
+/**
+ * Layouts a profile is dumped in
+ */
+enum Format : uint8_t
+{
+    //gperftools' heap profile text, which pprof reads together with the binary
+    Pprof,
+
+    //One line of semicolon-separated frames and estimated live bytes per call site, for flame graph tools
+    Folded
+};
+
+namespace sampling {
+    //Bytes the calling thread may still allocate before its next sample. It is shared by every profile the thread
+    //allocates for, so profiles sharing threads should share a rate too.
+    inline thread_local long countdown = 0;
+}
+
+/**
+ * Sampling heap profile. About one allocation per rate bytes is sampled, with the probability of sampling an
+ * allocation of a given size following from a Poisson process over allocated bytes, and the call stack of each
+ * sampled allocation is recorded until it is deallocated. Allocations that were not sampled cost a subtraction,
+ * and deallocations a probe of a lock-free table of the live samples while there are any.
+ */
+struct Profile
+{
+    /**
+     * @param rate bytes allocated between samples on average
+     */
+    explicit Profile(long rate = SAMPLE_RATE);
+
+    Profile(const Profile&) = delete;
+
+    /**
+     * Stop dumping on a signal, dumping one last time and restoring the signal's previous handler if no other
+     * profile dumps on it, if dump_on was called
+     */
+    ~Profile();
+
+    /**
+     * Account an allocation that ran the calling thread's countdown out, sampling it and drawing the next one. The
+     * thread's first allocation draws the countdown it starts with instead, and is sampled if it runs that out.
+     * @param p allocation
+     * @param bytes size in bytes
+     */
+    void sample(void* p, size_t bytes);
+
+    /**
+     * Stop tracking an allocation if it was sampled
+     * @param p allocation being deallocated
+     */
+    void forget(void* p) {
+        if (live.load(std::memory_order_relaxed) > 0 && filtered(p) && holds(p)) {
+            remove(p);
+        }
+    }
+
+    /**
+     * Write the live samples out
+     * @param out stream to write
+     * @param layout layout to write them in
+     */
+    void dump(FILE* out, Format layout) const;
+
+    /**
+     * Write the live samples to a file, replacing any previous one
+     * @param path file to write
+     * @param layout layout to write them in
+     * @return whether the file could be written
+     */
+    bool dump(const char* path, Format layout) const;
+
+    /**
+     * Dump to path.1, path.2 and so on each time the process receives a signal, and to path itself when the
+     * profile is destroyed. The signal's previous handler is replaced until the last profile dumping on it is
+     * destroyed, which restores it. Dumps are written by a thread of the profile's, as writing them is not safe in
+     * a signal handler.
+     * @param signal signal to dump on
+     * @param path file to write, numbered per dump
+     * @param layout layout to write them in
+     * @throws std::system_error if the signal cannot be handled
+     * @throws std::runtime_error if too many profiles dump on signals already
+     */
+    void dump_on(int signal, const char* path, Format layout);
+
+    /**
+     * Estimate the bytes of all live allocations from the live samples
+     * @return estimated live bytes
+     */
+    long estimate() const;
+
+    /**
+     * @return bytes allocated between samples on average
+     */
+    long rate() const { return interval; }
+
+private:
+    /**
+     * Samples sharing a call stack
+     */
+    struct Site
+    {
+        uintptr_t frames[FRAMES];
+        int depth;
+        uint64_t hash;
+
+        //Samples live now and ever taken, with their requested bytes
+        long live;
+        long live_bytes;
+        long total;
+        long total_bytes;
+
+        //Live bytes of every allocation the live samples stand for
+        double estimate;
+    };
+
+    /**
+     * A live sample, in the slot of its address
+     */
+    struct Entry
+    {
+        size_t bytes;
+        uint32_t site;
+    };
+
+    long interval;
+
+    //Addresses of the live samples, probed linearly and without a lock by deallocating threads
+    std::unique_ptr<std::atomic<uintptr_t>[]> slots;
+    std::unique_ptr<Entry[]> entries;
+    std::atomic<long> live{0};
+
+    //Bits set while a live sample hashes to them, with the number that do
+    std::atomic<uint64_t> filter[FILTER / 64] = {};
+    std::unique_ptr<uint16_t[]> hashed;
+
+    //Guards everything but the slots' loads
+    mutable std::mutex mutex;
+    std::vector<Site> sites;
+    std::unordered_multimap<uint64_t, uint32_t> index;
+
+    //Dumps on a signal, see dump_on
+    int ends[2] = {-1, -1};
+    int watcher = -1;
+    std::thread thread;
+    std::string target;
+    Format format = Pprof;
+
+    /**
+     * Bit of the filter an address hashes to
+     */
+    static size_t bit(const void* p) {
+        return (size_t) (((uint64_t) (uintptr_t) p >> 4) * 0x9E3779B97F4A7C15ULL >> 52) & (FILTER - 1);
+    }
+
+    /**
+     * Check the filter, which holds every live sample and few other addresses
+     */
+    bool filtered(const void* p) const {
+        return filter[bit(p) / 64].load(std::memory_order_relaxed) >> (bit(p) % 64) & 1;
+    }
+
+    /**
+     * Probe the table for a live sample without taking the lock
+     */
+    bool holds(void* p) const;
+
+    /**
+     * Remove a live sample
+     */
+    void remove(void* p);
+
+    /**
+     * Find the site of a call stack, registering it on its first sample, with the lock held
+     */
+    uint32_t site(const uintptr_t* frames, int depth);
+};
+
+/**
+ * Policy sampling allocations into a heap profile, shared by every copy of the allocator
+ */
+struct Sampling
+{
+    std::shared_ptr<Profile> profile;
+
+    /**
+     * Sample into the process-wide profile named by the PEARTREE_PROFILE environment variable, or not at all if
+     * unset. It is sampled every PEARTREE_PROFILE_RATE bytes, or SAMPLE_RATE if unset, and dumped in the pprof
+     * layout on PROFILE_SIGNAL and at exit.
+     */
+    Sampling();
+
+    /**
+     * Sample into a profile of its own
+     * @param rate bytes allocated between samples on average
+     */
+    explicit Sampling(long rate) : profile(std::make_shared<Profile>(rate)) {}
+
+    void attach(const Arena&) {}
+
+    void allocated(void* p, size_t bytes) {
+        if (profile && (sampling::countdown -= (long) bytes) < 0) {
+            profile->sample(p, bytes);
+        }
+    }
+
+    void deallocated(void* p, size_t) {
+        if (profile) {
+            profile->forget(p);
+        }
+    }
+
+    void failed(size_t) {}
+};
+
+#endif //WRITEQUEUECPP_PROFILE_H
@@ -0,0 +1,96 @@
+#include "Registry.h"
+
+#include <cstdint>
+#include <sys/mman.h>
+
+//Marks an entry whose mapping was removed, probing continues past it
+#define TOMBSTONE ((char*) -1)
+
+//Smallest table, in entries
+#define SEED 256
+
+Registry::~Registry() {
+    if (table) {
+        munmap(table, capacity * sizeof(Entry));
+    }
+}
+
+Registry::Entry* Registry::probe(void* start) {
+    //Mappings are page aligned, so drop the page offset before mixing
+    size_t hash = (size_t) (((uintptr_t) start >> 12) * 0x9E3779B97F4A7C15ULL);
+    for (size_t i = hash & (capacity - 1);; i = (i + 1) & (capacity - 1)) {
+        if (table[i].start == start || table[i].start == nullptr) {
+            return &table[i];
+        }
+    }
+}
+
+bool Registry::rehash(size_t size) {
+    //Keep the old table if the new one cannot be mapped
+    void* fresh = mmap(nullptr, size * sizeof(Entry), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (fresh == MAP_FAILED) {
+        return false;
+    }
+    Entry* old = table;
+    size_t before = capacity;
+    table = (Entry*) fresh;
+    capacity = size;
+    used = live;
+    for (size_t i = 0; i < before; i++) {
+        if (old[i].start && old[i].start != TOMBSTONE) {
+            *probe(old[i].start) = old[i];
+        }
+    }
+    if (old) {
+        munmap(old, before * sizeof(Entry));
+    }
+    return true;
+}
+
+bool Registry::insert(void* start, size_t len) {
+    std::lock_guard<std::mutex> guard(mutex);
+    //Keep at most half the table occupied, tombstones included
+    if ((used + 1) * 2 > capacity
+        && !rehash(capacity == 0 ? SEED : (live + 1) * 4 > capacity ? capacity * 2 : capacity)) {
+        return false;
+    }
+    *probe(start) = {(char*) start, len};
+    used++;
+    live++;
+    return true;
+}
+
+void Registry::resize(void* start, size_t len) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!table) {
+        return;
+    }
+    Entry* entry = probe(start);
+    if (entry->start) {
+        entry->len = len;
+    }
+}
+
+size_t Registry::remove(void* start) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!table) {
+        return 0;
+    }
+    Entry* entry = probe(start);
+    if (!entry->start) {
+        return 0;
+    }
+    size_t len = entry->len;
+    entry->start = TOMBSTONE;
+    live--;
+    return len;
+}
+
+size_t Registry::find(void* start) {
+    std::lock_guard<std::mutex> guard(mutex);
+    if (!table) {
+        return 0;
+    }
+    Entry* entry = probe(start);
+    return entry->start ? entry->len : 0;
+}
@@ -0,0 +1,66 @@
+#ifndef WRITEQUEUECPP_REGISTRY_H
+#define WRITEQUEUECPP_REGISTRY_H
+
+#include <cstddef>
+#include <mutex>
+
+/**
+ * Open-addressed table of the dedicated mappings behind large allocations, keyed by start address. Its
+ * storage is mapped directly so that it never allocates through the heap it serves.
+ */
+struct Registry
+{
+    struct Entry
+    {
+        char* start;
+        size_t len;
+    };
+
+    Entry* table = nullptr;
+    size_t capacity = 0;
+    size_t used = 0;
+    size_t live = 0;
+    std::mutex mutex;
+
+    Registry() = default;
+
+    Registry(const Registry&) = delete;
+
+    ~Registry();
+
+    /**
+     * Record a mapping
+     * @param start first byte of the mapping
+     * @param len length of the mapping in bytes
+     * @return whether it was recorded, false if the table could not grow
+     */
+    bool insert(void* start, size_t len);
+
+    /**
+     * Change the length of a mapping resized in place, which never grows the table
+     * @param start first byte of the mapping
+     * @param len new length of the mapping in bytes
+     */
+    void resize(void* start, size_t len);
+
+    /**
+     * Forget a mapping
+     * @param start first byte of the mapping
+     * @return length of the mapping, or zero if it is not registered
+     */
+    size_t remove(void* start);
+
+    /**
+     * Look a mapping up
+     * @param start first byte of the mapping
+     * @return length of the mapping, or zero if it is not registered
+     */
+    size_t find(void* start);
+
+private:
+    Entry* probe(void* start);
+
+    bool rehash(size_t size);
+};
+
+#endif //WRITEQUEUECPP_REGISTRY_H
@@ -0,0 +1,37 @@
+#include "Scope.h"
+
+Scope::Scope(Arena& arena, size_t bytes) : arena(&arena) {
+    //Build over all of the block, slack included, the arena holds it either way
+    len = (long) arena.capacity(fit(bytes));
+    block = arena.allocate(len);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    init(&tree, block, len);
+}
+
+Scope::Scope(Scope& parent, size_t bytes) : parent(&parent) {
+    len = (long) MINIMUM << Arena::rank(fit(bytes));
+    block = parent.allocate(len);
+    if (block == nullptr) {
+        throw std::bad_alloc();
+    }
+    init(&tree, block, len);
+}
+
+Scope::~Scope() {
+    if (parent) {
+        parent->deallocate(block, len);
+    }
+    else {
+        arena->deallocate(block, len);
+    }
+}
+
+long Scope::fit(size_t bytes) {
+    long len = (long) bytes;
+    while (len - prelude(len) < (long) bytes) {
+        len = (long) bytes + prelude(len);
+    }
+    return len;
+}
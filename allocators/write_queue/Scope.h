@@ -0,0 +1,119 @@
+#ifndef WRITEQUEUECPP_SCOPE_H
+#define WRITEQUEUECPP_SCOPE_H
+
+#include <cstddef>
+#include <limits>
+#include <new>
+
+#include "Arena.h"
+
+/**
+ * A tree of its own inside one block of an arena or of another scope, for allocations that die together such as
+ * those of a request. They need not be given back one by one: reset frees all of them at a cost proportional to
+ * the tree's metadata, and destroying the scope gives its block back to the parent in a single call, along with
+ * everything allocated in it. Scopes are not locked, so each is used by one thread at a time.
+ */
+struct Scope
+{
+    PearTree tree;
+
+    /**
+     * Take a block from an arena and build a tree over it
+     * @param arena arena to take the block from, outliving the scope
+     * @param bytes least bytes of heap the scope serves
+     * @throws std::bad_alloc if the arena cannot serve the block
+     */
+    Scope(Arena& arena, size_t bytes);
+
+    /**
+     * Take a block from another scope and build a tree over it
+     * @param parent scope to take the block from, outliving this one
+     * @param bytes least bytes of heap the scope serves
+     * @throws std::bad_alloc if the parent cannot serve the block
+     */
+    Scope(Scope& parent, size_t bytes);
+
+    Scope(const Scope&) = delete;
+
+    /**
+     * Give the block back to the arena or scope it was taken from, and every allocation with it
+     */
+    ~Scope();
+
+    /**
+     * Take a block from the scope
+     * @param size size in bytes
+     * @return pointer to the block, or null if the scope is exhausted
+     */
+    void* allocate(long size) { return take(&tree, size); }
+
+    /**
+     * Give a block back before the scope is reset, for allocations worth reusing within it
+     * @param pointer block taken from the scope
+     * @param size size in bytes it was taken with
+     */
+    void deallocate(void* pointer, long size) { give_sized(&tree, pointer, size); }
+
+    /**
+     * Free every allocation of the scope at once. Nested scopes must have been destroyed.
+     */
+    void reset() { ::reset(&tree); }
+
+    /**
+     * Count the bytes of heap the scope serves
+     * @return bytes behind the tree's metadata
+     */
+    size_t capacity() const { return (size_t) ((char*) tree.end - (char*) tree.base); }
+
+private:
+    Arena* arena = nullptr;
+    Scope* parent = nullptr;
+    void* block;
+    long len;
+
+    /**
+     * Determine the length of a block leaving at least a number of bytes behind the metadata of a tree over it
+     */
+    static long fit(size_t bytes);
+};
+
+/**
+ * Standard allocator over a Scope. Deallocation does nothing, the scope frees everything at once when it is reset
+ * or destroyed, so containers bound to it cost nothing to tear down.
+ */
+template<class T>
+struct ScopeAllocator
+{
+    [[maybe_unused]] typedef T value_type;
+
+    Scope* scope;
+
+    explicit ScopeAllocator(Scope& scope) noexcept : scope(&scope) {}
+
+    template<class U>
+    ScopeAllocator(const ScopeAllocator<U>& other) noexcept : scope(other.scope) {}
+
+    [[maybe_unused]] T* allocate(std::size_t n) {
+        if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+            throw std::bad_array_new_length();
+
+        if (void* p = scope->allocate((long) (n * sizeof(T))))
+            return static_cast<T*>(p);
+
+        throw std::bad_alloc();
+    }
+
+    [[maybe_unused]] void deallocate(T*, std::size_t) noexcept {}
+};
+
+template<class T, class U>
+bool operator==(const ScopeAllocator<T>& a, const ScopeAllocator<U>& b) {
+    return a.scope == b.scope;
+}
+
+template<class T, class U>
+bool operator!=(const ScopeAllocator<T>& a, const ScopeAllocator<U>& b) {
+    return a.scope != b.scope;
+}
+
+#endif //WRITEQUEUECPP_SCOPE_H
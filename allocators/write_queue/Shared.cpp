@@ -0,0 +1,142 @@
+#include "Shared.h"
+
+#include <cerrno>
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+//Identifies a shared segment
+#define MAGIC "PEARSHM"
+
+//Milliseconds an attaching process waits for the creator to initialize the segment
+#define PATIENCE 5000
+
+Shared::Shared(const char* name, size_t size) {
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    created = fd >= 0;
+    if (!created && errno == EEXIST) {
+        fd = shm_open(name, O_RDWR, 0600);
+    }
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), name);
+    }
+
+    if (created) {
+        //A fresh segment reads as zero, so the tree need not clear its metadata
+        mapping = page + (size + page - 1) / page * page;
+        if (ftruncate(fd, (off_t) mapping) != 0) {
+            int error = errno;
+            close(fd);
+            shm_unlink(name);
+            throw std::system_error(error, std::generic_category(), name);
+        }
+    }
+    else {
+        //The creator may not have sized the segment yet
+        struct stat info{};
+        for (int waited = 0; waited < PATIENCE; waited++) {
+            if (fstat(fd, &info) != 0 || (size_t) info.st_size > page) {
+                break;
+            }
+            usleep(1000);
+        }
+        mapping = (size_t) info.st_size;
+        if (mapping <= page) {
+            close(fd);
+            throw std::runtime_error("shared segment was never initialized");
+        }
+    }
+
+    void* start = mmap(nullptr, mapping, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    int error = errno;
+    close(fd);
+    if (start == MAP_FAILED) {
+        throw std::system_error(error, std::generic_category(), name);
+    }
+    segment = (Segment*) start;
+    char* heap = (char*) start + page;
+
+    if (created) {
+        memcpy(segment->magic, MAGIC, sizeof(segment->magic));
+        segment->version = SHARED_VERSION;
+        segment->minimum = MINIMUM;
+        segment->compact = COMPACT;
+        segment->len = mapping - page;
+        adopt(&tree, heap, (long) segment->len);
+        share(&tree);
+        segment->ready.store(1, std::memory_order_release);
+        return;
+    }
+
+    for (int waited = 0; !segment->ready.load(std::memory_order_acquire) && waited < PATIENCE; waited++) {
+        usleep(1000);
+    }
+    if (!segment->ready.load(std::memory_order_acquire)
+        || memcmp(segment->magic, MAGIC, sizeof(segment->magic)) != 0 || segment->version != SHARED_VERSION
+        || segment->minimum != MINIMUM || segment->compact != COMPACT || segment->len != mapping - page) {
+        munmap(start, mapping);
+        throw std::runtime_error("not a shared segment of this layout");
+    }
+
+    //The tables in the segment point into the creator's mapping, this process needs its own
+    size_t bytes = (size_t) tables((long) segment->len);
+    local = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (local == MAP_FAILED) {
+        error = errno;
+        munmap(start, mapping);
+        throw std::system_error(error, std::generic_category(), name);
+    }
+    attach(&tree, heap, (long) segment->len, local);
+}
+
+Shared::~Shared() {
+    if (local) {
+        munmap(local, (size_t) tables((long) segment->len));
+    }
+    munmap(segment, mapping);
+}
+
+void Shared::remove(const char* name) {
+    shm_unlink(name);
+}
+
+void Shared::enter() {
+    bool consistent = lock(&tree);
+    if (!consistent && !verify(&tree)) {
+        segment->broken.store(1, std::memory_order_relaxed);
+    }
+    if (segment->broken.load(std::memory_order_relaxed)) {
+        unlock(&tree);
+        throw std::runtime_error("shared tree was left broken by a process that died holding its lock");
+    }
+}
+
+void* Shared::allocate(long size) {
+    enter();
+    void* p = take(&tree, size);
+    unlock(&tree);
+    return p;
+}
+
+void Shared::deallocate(void* pointer) {
+    if (pointer == nullptr) {
+        return;
+    }
+    enter();
+    give(&tree, pointer);
+    unlock(&tree);
+}
+
+void Shared::deallocate(void* pointer, long size) {
+    if (pointer == nullptr) {
+        return;
+    }
+    enter();
+    give_sized(&tree, pointer, size);
+    unlock(&tree);
+}
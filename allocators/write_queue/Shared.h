@@ -0,0 +1,126 @@
+#ifndef WRITEQUEUECPP_SHARED_H
+#define WRITEQUEUECPP_SHARED_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+extern "C" {
+    #include "peartree.h"
+}
+
+//Layout version of shared segments, bumped whenever the tree's state region changes shape
+#define SHARED_VERSION 3
+
+/**
+ * A PearTree in a named shared memory segment, which any number of processes attach to and allocate from
+ * under the tree's process-shared lock. Blocks are handed between processes as offsets into the segment,
+ * see offset() and at(), so a buffer is passed without copying it.
+ *
+ * The lock is robust. If a process dies holding it, the next one to take it verifies the tree before
+ * continuing, and every process refuses to use a tree that fails verification.
+ */
+struct Shared
+{
+    /**
+     * Header in the first page of the segment
+     */
+    struct Segment
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t minimum;
+        uint32_t compact;
+
+        //Set once the creator has initialized the tree, attaching processes wait for it
+        std::atomic<uint32_t> ready;
+
+        //Set once the tree failed verification after a process died holding its lock
+        std::atomic<uint32_t> broken;
+
+        //Bytes of the tree following the header page
+        uint64_t len;
+    };
+
+    Segment* segment = nullptr;
+    PearTree tree{};
+    size_t mapping = 0;
+
+    //Process-local branch tables of a tree this process attached to rather than created
+    void* local = nullptr;
+
+    //Whether this process created the segment
+    bool created = false;
+
+    /**
+     * Attach to a named segment, creating it if no process has yet
+     * @param name shm_open name of the segment, starting with a slash
+     * @param size bytes of heap to create, ignored when attaching
+     * @throws std::system_error if the segment cannot be opened or mapped
+     * @throws std::runtime_error if the segment does not hold a tree of this layout, or its creator never
+     * finished initializing it
+     */
+    Shared(const char* name, size_t size);
+
+    Shared(const Shared&) = delete;
+
+    /**
+     * Unmap the segment, which lives on until it is removed and every process has detached
+     */
+    ~Shared();
+
+    /**
+     * Remove a segment's name, processes attached to it keep using it
+     * @param name shm_open name of the segment
+     */
+    static void remove(const char* name);
+
+    /**
+     * Take a block
+     * @param size size in bytes
+     * @return pointer to the block, or null if the heap is exhausted
+     * @throws std::runtime_error if the tree is broken
+     */
+    void* allocate(long size);
+
+    /**
+     * Give a block back, from any attached process
+     * @param pointer block to return, or null
+     * @throws std::runtime_error if the tree is broken
+     */
+    void deallocate(void* pointer);
+
+    /**
+     * Give a block back given the size it was taken with
+     * @param pointer block to return, or null
+     * @param size size in bytes
+     * @throws std::runtime_error if the tree is broken
+     */
+    void deallocate(void* pointer, long size);
+
+    /**
+     * Translate a pointer into the segment to a handle valid in every attached process
+     * @param pointer pointer into the segment, or null
+     * @return offset from the start of the segment, zero for null
+     */
+    uint64_t offset(const void* pointer) const {
+        return pointer ? (uint64_t) ((const char*) pointer - (const char*) segment) : 0;
+    }
+
+    /**
+     * Translate a handle back to a pointer in this process's mapping
+     * @param offset offset from the start of the segment, or zero
+     * @return pointer into the segment, null for zero
+     */
+    void* at(uint64_t offset) const {
+        return offset ? (char*) segment + offset : nullptr;
+    }
+
+private:
+    /**
+     * Take the tree's lock, verifying the tree if its previous holder died
+     */
+    void enter();
+};
+
+#endif //WRITEQUEUECPP_SHARED_H
@@ -0,0 +1,85 @@
+#include "Slab.h"
+#include "Arena.h"
+
+#include <new>
+
+void Slabs::unlink(Slab* slab) {
+    if (slab->prev) {
+        slab->prev->next = slab->next;
+    }
+    else {
+        partial = slab->next;
+    }
+    if (slab->next) {
+        slab->next->prev = slab->prev;
+    }
+    slab->prev = slab->next = nullptr;
+}
+
+int Slabs::take(Arena* arena, void** objects, int n) {
+    std::lock_guard<std::mutex> guard(mutex);
+    int got = 0;
+    while (got < n) {
+        Slab* slab = partial;
+        if (slab == nullptr) {
+            void* block = nullptr;
+            if (arena->refill(SLAB, &block, 1) == 0) {
+                break;
+            }
+            slab = new (block) Slab{nullptr, nullptr, nullptr, size, 0, 0, (int) ((SLAB - HEADER) / size)};
+            partial = slab;
+        }
+
+        //Reuse freed objects first, then carve the untouched tail of the slab
+        while (got < n && slab->used < slab->capacity) {
+            void* object = slab->free;
+            if (object) {
+                slab->free = *(void**) object;
+            }
+            else {
+                object = (char*) slab + HEADER + (size_t) slab->carved++ * size;
+            }
+            slab->used++;
+            objects[got++] = object;
+        }
+
+        if (slab->used == slab->capacity) {
+            unlink(slab);
+        }
+    }
+    return got;
+}
+
+void Slabs::give(Arena* arena, void** objects, int n) {
+    Slab* empty = nullptr;
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        for (int i = 0; i < n; i++) {
+            Slab* slab = header(&arena->within(objects[i])->tree, objects[i]);
+            *(void**) objects[i] = slab->free;
+            slab->free = objects[i];
+
+            //A full slab regains a free object and rejoins the list
+            if (slab->used-- == slab->capacity) {
+                slab->next = partial;
+                if (partial) {
+                    partial->prev = slab;
+                }
+                partial = slab;
+            }
+
+            //Keep the last slab of the class so that a single object bouncing in and out does not churn the trees
+            if (slab->used == 0 && (slab->prev || slab->next)) {
+                unlink(slab);
+                slab->next = empty;
+                empty = slab;
+            }
+        }
+    }
+
+    while (empty) {
+        void* block = empty;
+        empty = empty->next;
+        arena->release(SLAB, &block, 1);
+    }
+}
@@ -0,0 +1,94 @@
+#ifndef WRITEQUEUECPP_SLAB_H
+#define WRITEQUEUECPP_SLAB_H
+
+#include <mutex>
+
+extern "C" {
+    #include "peartree.h"
+}
+
+//Spacing of slab classes, which keeps every object aligned as malloc promises
+#define GRAIN 16
+
+//Largest request served from slabs
+#define SLABBED 256
+
+//Bytes per slab, a single block taken from the arena's trees
+#define SLAB 4096
+
+//Bytes at the start of a slab taken by its header
+#define HEADER ((sizeof(Slab) + GRAIN - 1) / GRAIN * GRAIN)
+
+struct Arena;
+
+/**
+ * Header at the start of a slab, a tree block carved into objects of a single size class
+ */
+struct Slab
+{
+    //Neighbours in the list of slabs with free objects
+    Slab* prev;
+    Slab* next;
+
+    //Objects given back, linked through their first word
+    void* free;
+
+    int size;
+    int used;
+    int carved;
+    int capacity;
+};
+
+/**
+ * Slabs of one size class. Requests that a power-of-two block would round up by more than a grain are
+ * served from objects of exactly their class instead, and slabs go back to the trees as whole blocks once
+ * all their objects are freed.
+ */
+struct Slabs
+{
+    std::mutex mutex;
+    Slab* partial = nullptr;
+    int size = 0;
+
+    /**
+     * Determine the slab class serving a request
+     * @param size size in bytes
+     * @return class, the objects holding class * GRAIN bytes, or -1 if the request is better served by a block
+     */
+    static int slot(long size) {
+        int s = (int) ((size + GRAIN - 1) / GRAIN);
+        return size <= SLABBED && (s & (s - 1)) ? s : -1;
+    }
+
+    /**
+     * Find the slab holding an object. Slabs are blocks of the tree, so they sit at multiples of SLAB from its base.
+     * @param tree tree the object was carved from
+     * @param object object inside a slab
+     * @return slab header
+     */
+    static Slab* header(PearTree* tree, void* object) {
+        return (Slab*) ((char*) tree->base + ((char*) object - (char*) tree->base) / SLAB * SLAB);
+    }
+
+    /**
+     * Take up to n objects, carving new slabs out of the arena as needed
+     * @param arena arena providing the slabs
+     * @param objects output array of objects
+     * @param n number of objects wanted
+     * @return number of objects taken
+     */
+    int take(Arena* arena, void** objects, int n);
+
+    /**
+     * Give objects back, returning slabs left empty to the arena
+     * @param arena arena the objects were taken from
+     * @param objects objects to return
+     * @param n number of objects
+     */
+    void give(Arena* arena, void** objects, int n);
+
+private:
+    void unlink(Slab* slab);
+};
+
+#endif //WRITEQUEUECPP_SLAB_H
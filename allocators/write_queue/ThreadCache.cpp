@@ -0,0 +1,158 @@
+#include "ThreadCache.h"
+
+namespace {
+    //Guards the list of live arenas, held by exiting threads so an arena cannot vanish mid-flush
+    std::mutex lifetimes;
+    Arena* living = nullptr;
+    unsigned long generation = 0;
+
+    bool alive(unsigned long id) {
+        for (Arena* arena = living; arena; arena = arena->link) {
+            if (arena->id == id) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Every cache owned by a thread, flushed back to their arenas when the thread exits
+     */
+    struct Caches
+    {
+        ThreadCache slots[SLOTS];
+
+        ~Caches() {
+            std::lock_guard<std::mutex> guard(lifetimes);
+            for (auto& slot : slots) {
+                if (slot.arena && alive(slot.id)) {
+                    slot.flush();
+                }
+            }
+        }
+    };
+
+    thread_local Caches caches;
+}
+
+ThreadCache* ThreadCache::local(Arena* arena) {
+    ThreadCache* empty = nullptr;
+    for (auto& slot : caches.slots) {
+        if (slot.id == arena->id) {
+            return &slot;
+        }
+        if (!slot.arena && !empty) {
+            empty = &slot;
+        }
+    }
+
+    //Every slot is taken, reclaim those of destroyed arenas
+    if (!empty) {
+        std::lock_guard<std::mutex> guard(lifetimes);
+        for (auto& slot : caches.slots) {
+            if (!alive(slot.id)) {
+                slot.abandon();
+                empty = empty ? empty : &slot;
+            }
+        }
+    }
+
+    if (empty) {
+        empty->arena = arena;
+        empty->id = arena->id;
+    }
+    return empty;
+}
+
+void ThreadCache::enlist(Arena* arena) {
+    std::lock_guard<std::mutex> guard(lifetimes);
+    arena->id = ++generation;
+    arena->link = living;
+    living = arena;
+}
+
+void ThreadCache::retire(Arena* arena) {
+    std::lock_guard<std::mutex> guard(lifetimes);
+    for (Arena** at = &living; *at; at = &(*at)->link) {
+        if (*at == arena) {
+            *at = arena->link;
+            break;
+        }
+    }
+    for (auto& slot : caches.slots) {
+        if (slot.id == arena->id) {
+            slot.abandon();
+        }
+    }
+}
+
+void ThreadCache::freeze() {
+    lifetimes.lock();
+}
+
+void ThreadCache::thaw() {
+    lifetimes.unlock();
+}
+
+int ThreadCache::rank(long size) const {
+    int s = arena->slot(size);
+    if (s >= 0) {
+        return CACHED + s;
+    }
+    int r = Arena::rank(size);
+    return r < CACHED && r < arena->regions[0].tree.layers ? r : -1;
+}
+
+void* ThreadCache::take(long size) {
+    int r = rank(size);
+    if (r < 0) {
+        void* p = nullptr;
+        arena->refill(size, &p, 1);
+        return p;
+    }
+
+    Magazine& mag = magazines[r];
+    if (mag.count == 0) {
+        mag.count = arena->refill(bytes(r), mag.blocks, MAGAZINE / 2);
+        if (mag.count == 0) {
+            return nullptr;
+        }
+    }
+
+    return mag.blocks[--mag.count];
+}
+
+void ThreadCache::give(void* pointer, long size) {
+    int r = rank(size);
+    if (r < 0) {
+        arena->release(size, &pointer, 1);
+        return;
+    }
+
+    //Flush the older half of a full magazine
+    Magazine& mag = magazines[r];
+    if (mag.count == MAGAZINE) {
+        arena->release(bytes(r), mag.blocks, MAGAZINE / 2);
+        for (int i = MAGAZINE / 2; i < MAGAZINE; i++) {
+            mag.blocks[i - MAGAZINE / 2] = mag.blocks[i];
+        }
+        mag.count -= MAGAZINE / 2;
+    }
+
+    mag.blocks[mag.count++] = pointer;
+}
+
+void ThreadCache::flush() {
+    for (int r = 0; r < MAGAZINES; r++) {
+        arena->release(bytes(r), magazines[r].blocks, magazines[r].count);
+        magazines[r].count = 0;
+    }
+}
+
+void ThreadCache::abandon() {
+    arena = nullptr;
+    id = 0;
+    for (auto& mag : magazines) {
+        mag.count = 0;
+    }
+}
@@ -0,0 +1,103 @@
+#ifndef WRITEQUEUECPP_THREADCACHE_H
+#define WRITEQUEUECPP_THREADCACHE_H
+
+#include <cstddef>
+
+#include "Arena.h"
+
+//Number of blocks a single magazine can hold
+#define MAGAZINE 32
+
+//Number of size classes served from magazines, starting at MINIMUM (16 bytes to 32 KiB)
+#define CACHED 12
+
+//Number of magazines, the slab classes following the block classes
+#define MAGAZINES (CACHED + SLABBED / GRAIN + 1)
+
+//Number of distinct arenas a single thread can cache blocks for
+#define SLOTS 8
+
+/**
+ * Fixed-capacity stack of free blocks of a single size class
+ */
+struct Magazine
+{
+    int count = 0;
+    void* blocks[MAGAZINE];
+};
+
+/**
+ * Per-thread front end of an arena. Blocks held in magazines stay allocated as far as their trees are
+ * concerned, so only refills and flushes take a tree's lock, each moving half a magazine at once.
+ * Caches are matched to arenas by identity rather than address, so a cache left behind by a destroyed
+ * arena is never mistaken for one of a new arena constructed at the same address.
+ */
+struct ThreadCache
+{
+    Arena* arena = nullptr;
+    unsigned long id = 0;
+    Magazine magazines[MAGAZINES];
+
+    /**
+     * Retrieve the calling thread's cache for an arena
+     * @param arena arena
+     * @return cache, or null if the thread already caches SLOTS other arenas
+     */
+    static ThreadCache* local(Arena* arena);
+
+    /**
+     * Register a new arena, giving it an identity no other arena ever had
+     * @param arena arena being constructed
+     */
+    static void enlist(Arena* arena);
+
+    /**
+     * Unregister an arena being destroyed. Blocks other threads still cache for it are abandoned, and
+     * their slots are reclaimed when those threads run out of slots or exit.
+     * @param arena arena being destroyed
+     */
+    static void retire(Arena* arena);
+
+    /**
+     * Take the lock guarding the list of live arenas, so a fork cannot happen while an exiting thread flushes
+     */
+    static void freeze();
+
+    /**
+     * Release the lock taken by freeze
+     */
+    static void thaw();
+
+    /**
+     * Take a block, refilling its magazine from the arena when empty
+     * @param size size in bytes
+     * @return pointer to the block, or null if the arena is exhausted
+     */
+    void* take(long size);
+
+    /**
+     * Give a block back, flushing half of its magazine to the arena when full
+     * @param pointer block to return
+     * @param size size in bytes the block was taken with
+     */
+    void give(void* pointer, long size);
+
+    /**
+     * Return every cached block to the arena
+     */
+    void flush();
+
+    /**
+     * Forget every cached block without returning it, for caches of destroyed arenas
+     */
+    void abandon();
+
+private:
+    int rank(long size) const;
+
+    static long bytes(int r) {
+        return r < CACHED ? (long) MINIMUM << r : (long) (r - CACHED) * GRAIN;
+    }
+};
+
+#endif //WRITEQUEUECPP_THREADCACHE_H
@@ -0,0 +1,149 @@
+#include "Trace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <system_error>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+//Identifies a trace file
+#define MAGIC "PEARTRCE"
+
+namespace {
+    std::atomic<unsigned long> traces{0};
+
+    /**
+     * The calling thread's chunk of the trace it last recorded to
+     */
+    struct Cached
+    {
+        unsigned long trace = 0;
+        void* chunk = nullptr;
+    };
+
+    thread_local Cached cached;
+
+    /**
+     * Write all of a buffer, retrying short writes
+     */
+    void emit(int fd, const void* data, size_t len) {
+        for (size_t sent = 0; sent < len;) {
+            ssize_t n = write(fd, (const char*) data + sent, len - sent);
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            if (n <= 0) {
+                return;
+            }
+            sent += (size_t) n;
+        }
+    }
+}
+
+Trace::Trace(const char* path) : id(++traces), start(std::chrono::steady_clock::now()) {
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        throw std::system_error(errno, std::generic_category(), path);
+    }
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(header.magic));
+    header.version = TRACE_VERSION;
+    header.record = sizeof(Record);
+    emit(fd, &header, sizeof(header));
+}
+
+Trace::~Trace() {
+    for (int i = 0; i < threads; i++) {
+        flush(chunks[i]);
+        munmap(chunks[i], sizeof(Chunk));
+    }
+    close(fd);
+}
+
+Trace::Chunk* Trace::local() {
+    if (cached.trace == id) {
+        return (Chunk*) cached.chunk;
+    }
+
+    std::lock_guard<std::mutex> guard(mutex);
+    std::thread::id self = std::this_thread::get_id();
+    Chunk* found = nullptr;
+    for (int i = 0; i < threads; i++) {
+        if (chunks[i]->owner == self) {
+            found = chunks[i];
+        }
+    }
+    if (found == nullptr && threads < THREADS) {
+        void* memory = mmap(nullptr, sizeof(Chunk), PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+        //Try again on the thread's next record
+        if (memory == MAP_FAILED) {
+            return nullptr;
+        }
+        found = new (memory) Chunk;
+        found->owner = self;
+        found->thread = (uint16_t) threads;
+        found->count = 0;
+        chunks[threads++] = found;
+    }
+    cached = {id, found};
+    return found;
+}
+
+void Trace::flush(Chunk* chunk) {
+    emit(fd, chunk->records, sizeof(Record) * (size_t) chunk->count);
+    chunk->count = 0;
+}
+
+void Trace::record(Operation op, const void* address, size_t size) {
+    Chunk* chunk = local();
+    if (chunk == nullptr) {
+        lost.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    Record& record = chunk->records[chunk->count++];
+    record.time = (uint64_t) std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+    record.address = (uint64_t) (uintptr_t) address;
+    record.size = size;
+    record.thread = chunk->thread;
+    record.op = op;
+    if (chunk->count == TRACED) {
+        std::lock_guard<std::mutex> guard(mutex);
+        flush(chunk);
+    }
+}
+
+bool Trace::read(const char* path, std::vector<Record>& records) {
+    FILE* file = fopen(path, "rb");
+    if (file == nullptr) {
+        return false;
+    }
+    Header header{};
+    bool valid = fread(&header, sizeof(header), 1, file) == 1
+                 && memcmp(header.magic, MAGIC, sizeof(header.magic)) == 0
+                 && header.version == TRACE_VERSION && header.record == sizeof(Record);
+    Record record{};
+    while (valid && fread(&record, sizeof(record), 1, file) == 1) {
+        records.push_back(record);
+    }
+    fclose(file);
+
+    //Each thread's records are in order already, batches of different threads are not
+    std::stable_sort(records.begin(), records.end(), [](const Record& a, const Record& b) { return a.time < b.time; });
+    return valid;
+}
+
+Tracing::Tracing() {
+    //Every allocator recording to the environment's trace shares it, so none truncates another's records
+    static std::shared_ptr<Trace> shared = [] {
+        const char* path = getenv("PEARTREE_TRACE");
+        return path && *path ? std::make_shared<Trace>(path) : std::shared_ptr<Trace>();
+    }();
+    trace = shared;
+}
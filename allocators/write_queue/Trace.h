@@ -0,0 +1,179 @@
+#ifndef WRITEQUEUECPP_TRACE_H
+#define WRITEQUEUECPP_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+struct Arena;
+
+//Records each thread buffers before writing them out
+#define TRACED 4096
+
+//Threads a trace tells apart, as many as Record::thread can number. Records of further threads are dropped.
+#define THREADS (1 << 12)
+
+//Layout version of trace files
+#define TRACE_VERSION 1
+
+/**
+ * Calls a trace records
+ */
+enum Operation : uint8_t
+{
+    Allocated,
+    Deallocated,
+    Failed
+};
+
+/**
+ * One call, packed into 24 bytes
+ */
+struct Record
+{
+    //Nanoseconds since the trace was opened
+    uint64_t time;
+
+    //Address of the allocation, which identifies it until it is deallocated
+    uint64_t address;
+
+    uint64_t size : 48;
+
+    //Sequence number of the calling thread within the trace
+    uint64_t thread : 12;
+
+    uint64_t op : 4;
+};
+
+/**
+ * Binary trace of allocator calls streamed to a file. Each thread fills a buffer of its own and only takes
+ * the trace's lock to write a full one out, so records of different threads appear in the file in batches
+ * rather than in time order.
+ */
+struct Trace
+{
+    /**
+     * Header at the start of a trace file
+     */
+    struct Header
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t record;
+    };
+
+    /**
+     * Create a trace file, replacing any previous one
+     * @param path file to write
+     * @throws std::system_error if the file cannot be created
+     */
+    explicit Trace(const char* path);
+
+    Trace(const Trace&) = delete;
+
+    /**
+     * Write out every thread's buffered records and close the file. No thread may still be recording.
+     */
+    ~Trace();
+
+    /**
+     * Record a call
+     * @param op call made
+     * @param address allocation, or null for a failure
+     * @param size size in bytes
+     */
+    void record(Operation op, const void* address, size_t size);
+
+    /**
+     * @return records left out, those of threads beyond THREADS or whose buffer could not be mapped
+     */
+    long dropped() const { return lost.load(std::memory_order_relaxed); }
+
+    /**
+     * Read a trace back, ordered by time
+     * @param path trace file
+     * @param records set to the trace's records
+     * @return whether the file holds a trace of this layout
+     */
+    static bool read(const char* path, std::vector<Record>& records);
+
+private:
+    /**
+     * Records a single thread buffered
+     */
+    struct Chunk
+    {
+        std::thread::id owner;
+        uint16_t thread;
+        int count;
+        Record records[TRACED];
+    };
+
+    int fd = -1;
+    unsigned long id;
+    std::chrono::steady_clock::time_point start;
+    std::mutex mutex;
+    std::atomic<long> lost{0};
+
+    //Chunks are mapped directly, so a first record never throws out of a deallocation or allocates through the
+    //heap it traces
+    Chunk* chunks[THREADS] = {};
+    int threads = 0;
+
+    /**
+     * Find the calling thread's chunk, registering one on its first record
+     * @return chunk, or null if the trace numbers THREADS threads already or the chunk cannot be mapped
+     */
+    Chunk* local();
+
+    /**
+     * Write a chunk's records out, with the lock held
+     */
+    void flush(Chunk* chunk);
+};
+
+/**
+ * Policy recording every call to a trace, shared by every copy of the allocator
+ */
+struct Tracing
+{
+    std::shared_ptr<Trace> trace;
+
+    /**
+     * Record to the process-wide trace named by the PEARTREE_TRACE environment variable, or nowhere if unset
+     */
+    Tracing();
+
+    /**
+     * Record to a trace of its own
+     * @param path file to write
+     */
+    explicit Tracing(const char* path) : trace(std::make_shared<Trace>(path)) {}
+
+    void attach(const Arena&) {}
+
+    void allocated(void* p, size_t bytes) {
+        if (trace) {
+            trace->record(Allocated, p, bytes);
+        }
+    }
+
+    void deallocated(void* p, size_t bytes) {
+        if (trace) {
+            trace->record(Deallocated, p, bytes);
+        }
+    }
+
+    void failed(size_t bytes) {
+        if (trace) {
+            trace->record(Failed, nullptr, bytes);
+        }
+    }
+};
+
+#endif //WRITEQUEUECPP_TRACE_H
@@ -1,32 +1,178 @@
 #include "WriteQueueAllocator.h"
 
-template<class T>
-WriteQueueAllocator<T>::WriteQueueAllocator(size_t heap_size) {
-    std::cout << "[write_queue] initialized tree with heap size " << heap_size << std::endl;
-    void* base = mmap(nullptr, heap_size, PROT_READ | PROT_WRITE, MAP_ANON | MAP_SHARED, -1, 0);
-    assert(sizeof(SignPost) <= MINIMUM);
-    init(&tree, base, (long) heap_size);
+template<class T, class Policy>
+WriteQueueAllocator<T, Policy>::WriteQueueAllocator(size_t heap_size, int shards) {
+    arena = std::make_shared<Arena>(heap_size, shards);
+    Policy::attach(*arena);
 }
 
-template<class T>
+template<class T, class Policy>
+WriteQueueAllocator<T, Policy>::WriteQueueAllocator(size_t heap_size, const Config& config) {
+    arena = std::make_shared<Arena>(heap_size, config);
+    Policy::attach(*arena);
+}
+
+template<class T, class Policy>
+WriteQueueAllocator<T, Policy>::WriteQueueAllocator(size_t heap_size, const Config& config, const Policy& policy)
+    : Policy(policy) {
+    arena = std::make_shared<Arena>(heap_size, config);
+    Policy::attach(*arena);
+}
+
+template<class T, class Policy>
 template<class U>
-constexpr WriteQueueAllocator<T>::WriteQueueAllocator(const WriteQueueAllocator <U>&) noexcept {}
+WriteQueueAllocator<T, Policy>::WriteQueueAllocator(const WriteQueueAllocator <U, Policy>& other) noexcept
+    : Policy(other), arena(other.arena) {}
 
-template<class T>
-[[maybe_unused]] T* WriteQueueAllocator<T>::allocate(std::size_t n) {
-    void *p = take(&tree, (long) n * sizeof(T));
-    std::cout << "[write_queue] allocated " << n * sizeof(T) << " bytes at " << p << std::endl;
-    return (int *) p;
+template<class T, class Policy>
+[[maybe_unused]] T* WriteQueueAllocator<T, Policy>::allocate(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+
+    if (void *p = arena->allocate((long) (n * sizeof(T))))
+    {
+        Policy::allocated(p, n * sizeof(T));
+        return static_cast<T*>(p);
+    }
+
+    Policy::failed(n * sizeof(T));
+    throw std::bad_alloc();
 }
 
-template<class T>
-[[maybe_unused]] void WriteQueueAllocator<T>::deallocate(T* p, std::size_t n) noexcept {
-    std::cout << "[write_queue] freed " << n * sizeof(T) << " bytes at " << p << std::endl;
-    give(&tree, p);
+template<class T, class Policy>
+[[maybe_unused]] void WriteQueueAllocator<T, Policy>::deallocate(T* p, std::size_t n) noexcept {
+    Policy::deallocated(p, n * sizeof(T));
+    arena->deallocate(p, (long) (n * sizeof(T)));
 }
 
-template<class T, class U>
-bool operator==(const WriteQueueAllocator <T>&, const WriteQueueAllocator <U>&) { return true; }
+template<class T, class Policy>
+[[maybe_unused]] allocation_result<T*> WriteQueueAllocator<T, Policy>::allocate_at_least(std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+
+    //The slack rounds to the same block, so deallocating the reported count frees it as sized. Blocks rounded up
+    //to the large threshold only report counts short of it, as counts at or beyond it are freed as mappings.
+    long bytes = (long) (n * sizeof(T));
+    std::size_t slack = arena->capacity(bytes);
+    if (!arena->large(bytes) && arena->large((long) slack)) {
+        slack = arena->config.large - 1;
+    }
+    std::size_t count = std::max(n, slack / sizeof(T));
+    if (void *p = arena->allocate(bytes))
+    {
+        Policy::allocated(p, count * sizeof(T));
+        return {static_cast<T*>(p), count};
+    }
+
+    Policy::failed(n * sizeof(T));
+    throw std::bad_alloc();
+}
+
+template<class T, class Policy>
+[[maybe_unused]] void WriteQueueAllocator<T, Policy>::allocate_many(T** out, std::size_t count, std::size_t n) {
+    if (n > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+
+    long bytes = (long) (n * sizeof(T));
+    void** blocks = reinterpret_cast<void**>(out);
+    std::size_t most = std::numeric_limits<int>::max();
+    std::size_t got = 0;
+    while (got < count) {
+        //Large allocations are separate mappings and gain nothing from batching
+        int taken = 0;
+        if (arena->large(bytes)) {
+            blocks[got] = arena->allocate(bytes);
+            taken = blocks[got] != nullptr;
+        }
+        else {
+            taken = arena->refill(bytes, blocks + got, (int) std::min(count - got, most));
+        }
+        if (taken == 0) {
+            break;
+        }
+        got += (std::size_t) taken;
+    }
+
+    //Leave nothing allocated when the burst cannot be served in full
+    if (got < count) {
+        for (std::size_t i = 0; i < got; i++) {
+            arena->deallocate(blocks[i], bytes);
+        }
+        Policy::failed(count * n * sizeof(T));
+        throw std::bad_alloc();
+    }
+    for (std::size_t i = 0; i < count; i++) {
+        Policy::allocated(out[i], n * sizeof(T));
+    }
+}
+
+template<class T, class Policy>
+[[maybe_unused]] void WriteQueueAllocator<T, Policy>::deallocate_many(T** p, std::size_t count,
+                                                                     std::size_t n) noexcept {
+    long bytes = (long) (n * sizeof(T));
+    for (std::size_t i = 0; i < count; i++) {
+        Policy::deallocated(p[i], n * sizeof(T));
+    }
+    if (arena->large(bytes)) {
+        for (std::size_t i = 0; i < count; i++) {
+            arena->deallocate(p[i], bytes);
+        }
+        return;
+    }
+    void** blocks = reinterpret_cast<void**>(p);
+    std::size_t most = std::numeric_limits<int>::max();
+    for (std::size_t i = 0; i < count; i += most) {
+        arena->release(bytes, blocks + i, (int) std::min(count - i, most));
+    }
+}
 
-template<class T, class U>
-bool operator!=(const WriteQueueAllocator <T>&, const WriteQueueAllocator <U>&) { return false; }
\ No newline at end of file
+template<class T, class Policy>
+[[maybe_unused]] T* WriteQueueAllocator<T, Policy>::reallocate(T* p, std::size_t n, std::size_t m) {
+    if (m > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        throw std::bad_array_new_length();
+
+    if (void *q = arena->reallocate(p, (long) (n * sizeof(T)), (long) (m * sizeof(T))))
+    {
+        if (p) {
+            Policy::deallocated(p, n * sizeof(T));
+        }
+        Policy::allocated(q, m * sizeof(T));
+        return static_cast<T*>(q);
+    }
+
+    Policy::failed(m * sizeof(T));
+    throw std::bad_alloc();
+}
+
+template<class T, class Policy>
+[[maybe_unused]] bool WriteQueueAllocator<T, Policy>::try_expand(T* p, std::size_t n, std::size_t m) noexcept {
+    if (m > std::numeric_limits<std::size_t>::max() / sizeof(T))
+        return false;
+
+    if (!arena->try_expand(p, (long) (n * sizeof(T)), (long) (m * sizeof(T))))
+        return false;
+
+    Policy::deallocated(p, n * sizeof(T));
+    Policy::allocated(p, m * sizeof(T));
+    return true;
+}
+
+template<class T, class Policy>
+[[maybe_unused]] bool WriteQueueAllocator<T, Policy>::shrink_in_place(T* p, std::size_t n, std::size_t m) noexcept {
+    if (!arena->shrink_in_place(p, (long) (n * sizeof(T)), (long) (m * sizeof(T))))
+        return false;
+
+    Policy::deallocated(p, n * sizeof(T));
+    Policy::allocated(p, m * sizeof(T));
+    return true;
+}
+
+template<class T, class U, class Policy>
+bool operator==(const WriteQueueAllocator <T, Policy>& a, const WriteQueueAllocator <U, Policy>& b) {
+    return a.arena == b.arena;
+}
+
+template<class T, class U, class Policy>
+bool operator!=(const WriteQueueAllocator <T, Policy>& a, const WriteQueueAllocator <U, Policy>& b) {
+    return a.arena != b.arena;
+}
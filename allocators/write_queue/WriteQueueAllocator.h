@@ -1,39 +1,140 @@
 #ifndef WRITEQUEUECPP_WRITEQUEUEALLOCATOR_H
 #define WRITEQUEUECPP_WRITEQUEUEALLOCATOR_H
 
+#include <algorithm>
 #include <cstdlib>
 #include <iostream>
 #include <limits>
+#include <memory>
 #include <new>
+#include <type_traits>
 #include <vector>
-#include <sys/mman.h>
 
-extern "C" {
-    #include "peartree.h"
-}
+#include "Arena.h"
+#include "Instrumentation.h"
+#include "Profile.h"
+#include "Trace.h"
 
-template<class T>
-struct WriteQueueAllocator
+/**
+ * Result of allocate_at_least, standing in for C++23's std::allocation_result
+ */
+template<class Pointer>
+struct allocation_result
+{
+    Pointer ptr;
+    std::size_t count;
+};
+
+/**
+ * Standard allocator over an Arena. Copies and rebound copies share the arena through a reference count,
+ * so node-based containers allocating their nodes through a rebound copy use the same trees, and the
+ * arena is unmapped once the last copy is destroyed.
+ */
+template<class T, class Policy = Silent>
+struct WriteQueueAllocator : Policy
 {
     [[maybe_unused]] typedef T value_type;
 
-    PearTree tree = (PearTree){nullptr};
+    //Containers take the arena along when moved or swapped, so their blocks keep a valid owner
+    typedef std::true_type propagate_on_container_move_assignment;
+    typedef std::true_type propagate_on_container_swap;
+
+    std::shared_ptr<Arena> arena;
 
-    explicit WriteQueueAllocator(size_t heap_size);
+    explicit WriteQueueAllocator(size_t heap_size, int shards = 1);
+
+    WriteQueueAllocator(size_t heap_size, const Config& config);
+
+    /**
+     * Construct over a new arena with a policy of its own, such as a Tracing policy recording to a file or a
+     * Sampling policy profiling at a rate of its own
+     * @param heap_size bytes per shard
+     * @param config arena configuration
+     * @param policy instrumentation policy, shared by copies of the allocator
+     */
+    WriteQueueAllocator(size_t heap_size, const Config& config, const Policy& policy);
 
     template<class U>
-    constexpr explicit WriteQueueAllocator(const WriteQueueAllocator <U>&) noexcept;
+    WriteQueueAllocator(const WriteQueueAllocator <U, Policy>& other) noexcept;
 
     [[maybe_unused]] T* allocate(std::size_t n);
 
     [[maybe_unused]] void deallocate(T* p, std::size_t n) noexcept;
+
+    /**
+     * Allocate at least n objects, reporting every object the block serving them can hold
+     * @param n least number of objects
+     * @return allocation and the number of objects it holds, to be given back to deallocate
+     */
+    [[maybe_unused]] allocation_result<T*> allocate_at_least(std::size_t n);
+
+    /**
+     * Allocate a burst of same-sized allocations, splitting free blocks once for the whole burst
+     * @param out output array of count allocations
+     * @param count number of allocations
+     * @param n number of objects in each allocation
+     */
+    [[maybe_unused]] void allocate_many(T** out, std::size_t count, std::size_t n = 1);
+
+    /**
+     * Deallocate a burst of same-sized allocations, freeing runs of neighbouring blocks together
+     * @param p array of count allocations, reordered by the call
+     * @param count number of allocations
+     * @param n number of objects in each allocation
+     */
+    [[maybe_unused]] void deallocate_many(T** p, std::size_t count, std::size_t n = 1) noexcept;
+
+    /**
+     * Grow an allocation without moving it, claiming the free buddies of its block
+     * @param p allocation of n objects
+     * @param n number of objects it was allocated with
+     * @param m number of objects wanted
+     * @return whether p now holds m objects and is deallocated as such, p is unchanged otherwise
+     */
+    [[maybe_unused]] bool try_expand(T* p, std::size_t n, std::size_t m) noexcept;
+
+    /**
+     * Shrink an allocation without moving it, giving the halves of its block it no longer needs back
+     * @param p allocation of n objects
+     * @param n number of objects it was allocated with
+     * @param m number of objects to keep
+     * @return whether p now holds m objects and is deallocated as such, p is unchanged otherwise
+     */
+    [[maybe_unused]] bool shrink_in_place(T* p, std::size_t n, std::size_t m) noexcept;
+
+    /**
+     * Resize an allocation, large allocations are remapped rather than copied
+     * @param p allocation of n objects, or null
+     * @param n number of objects it was allocated with
+     * @param m number of objects wanted
+     * @return allocation of m objects holding the first min(n, m) objects of p
+     */
+    [[maybe_unused]] T* reallocate(T* p, std::size_t n, std::size_t m);
+
+    /**
+     * Return the pages of the arena's free blocks to the system
+     * @return number of bytes released
+     */
+    size_t trim() { return arena->trim(); }
+
+    /**
+     * Merge the free blocks whose merges the arena put off, see Config::deferred
+     * @return number of pairs merged
+     */
+    long coalesce() { return arena->coalesce(); }
+
+    /**
+     * Access the instrumentation policy, e.g. policy().stats() for a Counting allocator
+     * @return policy shared by this allocator's copies
+     */
+    const Policy& policy() const { return *this; }
 };
 
-template<class T, class U>
-bool operator==(const WriteQueueAllocator <T>&, const WriteQueueAllocator <U>&);
+template<class T, class U, class Policy>
+bool operator==(const WriteQueueAllocator <T, Policy>&, const WriteQueueAllocator <U, Policy>&);
 
-template<class T, class U>
-bool operator!=(const WriteQueueAllocator <T>&, const WriteQueueAllocator <U>&);
+template<class T, class U, class Policy>
+bool operator!=(const WriteQueueAllocator <T, Policy>&, const WriteQueueAllocator <U, Policy>&);
 
 
 #endif //WRITEQUEUECPP_WRITEQUEUEALLOCATOR_H
@@ -3,11 +3,19 @@
 //
 #include "peartree.h"
 
-//Convenience integer size constant in bits
-#define INTSIZE (int)(sizeof(int) * 8)
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+//Convenience word size constant in bits
+#define WORDSIZE (int)(sizeof(uint64_t) * 8)
+
+//Number of layers covered by a single word, a node's descendants this many layers down share one word
+#define STRIDE 6
 
 //Calculate the block size for a given layer or class
-#define block(layerc, layer) (MINIMUM << (layerc - (layer) - 1))
+#define block(layerc, layer) ((long)MINIMUM << (layerc - (layer) - 1))
 
 //Locate the memory block associated with an index and class
 #define locate(tree, class, index) (tree->base + (index * block(tree->layers, class)))
@@ -20,21 +28,21 @@
 
 //Retrieve the value of any node for any class or layer, not guaranteed to be one or zero
 #define value(tree, class, layer, index) \
-    (tree->branches[class][layer][(index) / INTSIZE] & (1 << ((index) % INTSIZE)))
+    (tree->branches[class][layer][(index) / WORDSIZE] & (1ULL << ((index) % WORDSIZE)))
 
 //Set the value of a node at any layer to one
 #define set(tree, class, layer, index) \
     assert(index < tree->segments);      \
-    tree->branches[class][layer][(index) / INTSIZE] |= (1 << ((index) % INTSIZE))
+    tree->branches[class][layer][(index) / WORDSIZE] |= (1ULL << ((index) % WORDSIZE))
 
 //Set the value of a node at any layer to zero
 #define unset(tree, class, layer, index) \
-    tree->branches[class][layer][(index) / INTSIZE] &= ~(1 << ((index) % INTSIZE))
+    tree->branches[class][layer][(index) / WORDSIZE] &= ~(1ULL << ((index) % WORDSIZE))
 
 //Retrieve the values of the children of a given node
 #define pear(tree, class, layer, index) (\
-    (tree->branches[class][layer + 1][child(index) / INTSIZE] & (3 << (child(index) % INTSIZE)))\
-    >> (child(index) % INTSIZE)\
+    (tree->branches[class][layer + 1][child(index) / WORDSIZE] & (3ULL << (child(index) % WORDSIZE)))\
+    >> (child(index) % WORDSIZE)\
 )
 
 //Calculate the index of an allocation block
@@ -43,97 +51,228 @@
 //Round-up integer division
 #define seg(num, den) ((num / den) + ((num) % (den) ? 1 : 0))
 
-//Calculate number of ints required to store a bitset of a given size
-#define pack(l) (seg(l, INTSIZE))
+//Calculate number of words required to store a bitset of a given size
+#define pack(l) (seg(l, WORDSIZE))
+
+//Index of the leftmost or rightmost set bit of a non-zero word
+#define scan(word, leftmost) ((leftmost) ? __builtin_ctzll(word) : WORDSIZE - 1 - __builtin_clzll(word))
 
-//Calculate the size in ints required to store a layers state
+//Calculate the size in words required to store a layers state
 #define sizer(len, layerc, layer) pack(seg(len, block(layerc, layer)))
 
-//Initialize a PearTree
-void init(PearTree* tree, void* start, long len) {
+//Whether a layer of a class tree is stored, compact trees only keep those the descent reads
+#define stored(class, layer) (!COMPACT || (layer) % STRIDE == 0 || (layer) == (class))
 
-    ///Determine parameters of state region
+//Next stored layer above a stored layer of a class tree
+#define rise(layer) (!COMPACT ? (layer) - 1 : (layer) % STRIDE ? (layer) - (layer) % STRIDE : (layer) - STRIDE)
+
+//Values of the 1 << span nodes below a node span layers up, span being at most STRIDE
+#define brood(tree, class, layer, index, span) (\
+    (tree->branches[class][layer][((index) << (span)) / WORDSIZE] >> (((index) << (span)) % WORDSIZE))\
+    & ((span) == STRIDE ? ~0ULL : (1ULL << (1 << (span))) - 1)\
+)
+
+//Number of smallest block sizes whose marks fit in a nibble, larger blocks keep theirs in the coarse array
+#define SPARSE 7
+
+//Bytes of allocation marks for a number of minimum blocks
+#define marks(allocs) (COMPACT ? seg(allocs, 2) + seg(allocs, (1 << SPARSE)) : (allocs))
+
+/**
+ * Read the mark of a minimum block
+ * @param tree peartree pointer
+ * @param granule index of the minimum block
+ * @return class + 1 if an allocated block starts there, ~class if a queued block does, zero otherwise
+ */
+static inline char mark(PearTree* tree, long granule) {
+    if (!COMPACT) {
+        return tree->alloc[granule];
+    }
+
+    //Nibbles 1 to 7 hold allocated blocks of the smallest sizes, 8 to 14 queued ones
+    int nibble = (tree->alloc[granule / 2] >> (granule % 2 * 4)) & 15;
+    if (nibble == 15) {
+        return tree->coarse[granule >> SPARSE];
+    }
+    if (nibble == 0) {
+        return 0;
+    }
+    int class = tree->layers - 1 - (nibble - 1) % SPARSE;
+    return nibble <= SPARSE ? (char)(class + 1) : ~((char)class);
+}
+
+/**
+ * Write the mark of a minimum block
+ * @param tree peartree pointer
+ * @param granule index of the minimum block
+ * @param value class + 1 for an allocated block, ~class for a queued one, zero for neither
+ */
+static inline void stamp(PearTree* tree, long granule, char value) {
+    if (!COMPACT) {
+        tree->alloc[granule] = value;
+        return;
+    }
+
+    int nibble = 0;
+    if (value) {
+        int rank = tree->layers - 1 - (value > 0 ? value - 1 : ~value);
+        if (rank < SPARSE) {
+            nibble = (value > 0 ? 1 : 1 + SPARSE) + rank;
+        }
+        else {
+            //Blocks this large start on multiples of their size, so a coarse entry is theirs alone
+            nibble = 15;
+            tree->coarse[granule >> SPARSE] = value;
+        }
+    }
+    char* byte = tree->alloc + granule / 2;
+    int shift = granule % 2 * 4;
+    *byte = (char)((*byte & ~(15 << shift)) | (nibble << shift));
+}
+
+/**
+ * Offsets of the parts of a tree's state region, in bytes from its start
+ */
+typedef struct LayoutStruct {
+    int layers;
+    long allocs;
+    long initial;
+    long latch;
+    long begin;
+    long middle;
+    long overhead;
+} Layout;
+
+/**
+ * Determines the parameters of the state region of a tree
+ * @param len bytes in the memory block
+ * @return layout of everything in front of the bitmaps
+ */
+static Layout plan(long len) {
+    Layout at;
 
     //Count the number of tree layers required
-    int layers = 1;
-    for (long con = len; con > MINIMUM; con = (con >> 1) + (con & 1), layers++);
+    at.layers = 1;
+    for (long con = len; con > MINIMUM; con = (con >> 1) + (con & 1), at.layers++);
     //Calculate the required capacity of each layer with Gauss's formula and store in sizes space
-    long allocs = len / MINIMUM;
-    int initial = seg((int)sizeof(char) * allocs, (int)sizeof(int)) * (int)sizeof(int);
-    int begin = initial + (int)sizeof(long) * 2 * layers;
-    int middle = begin + (int)sizeof(int*) * layers;
-    int overhead = middle + (int)sizeof(int*) * ((layers * (layers + 1)) / 2);
+    at.allocs = len / MINIMUM;
+    at.initial = seg((long)sizeof(char) * marks(at.allocs), (long)sizeof(uint64_t)) * (long)sizeof(uint64_t);
+    at.latch = at.initial + (long)sizeof(long) * 4 * at.layers + (long)sizeof(uint64_t);
+    at.begin = at.latch + seg((long)sizeof(pthread_mutex_t), (long)sizeof(long)) * (long)sizeof(long);
+    at.middle = at.begin + (long)sizeof(uint64_t**) * at.layers;
+    at.overhead = at.middle + (long)sizeof(uint64_t*) * ((at.layers * (at.layers + 1)) / 2);
+    return at;
+}
+
+long prelude(long len) {
+    Layout at = plan(len);
+    long bytes = at.overhead;
+    for (int i = 0; i < at.layers; i++) {
+        for (int j = 0; j <= i; j++) {
+            bytes += stored(i, j) ? sizer(len, at.layers, j) * (long)sizeof(uint64_t) : 0;
+        }
+    }
+    return seg(bytes, MINIMUM) * MINIMUM;
+}
+
+/**
+ * Points a tree at the state region of a memory block, writing the branch tables and optionally the lock but
+ * leaving every state value as it is
+ * @param tree tree pointer
+ * @param start pointer to the beginning of the memory block
+ * @param len bytes in the memory block
+ * @param tables where to write the branch tables, null for their place in the state region
+ * @param latch whether to initialize the lock
+ */
+static void frame(PearTree* tree, void* start, long len, void* tables, bool latch) {
+
+    ///Determine parameters of state region
+
+    Layout at = plan(len);
+    int layers = at.layers;
 
     ///Initialize tree pointers
 
     //Tree pointer
-    int*** branches = start + begin;
+    uint64_t*** branches = tables ? tables : start + at.begin;
     //Subtree pointer
-    int** head = start + middle;
+    uint64_t** head = (void*)branches + (at.middle - at.begin);
     //Branch pointer
-    int* tail = start + overhead;
+    uint64_t* tail = start + at.overhead;
     for (int i = 0; i < layers; i++) {
         //Set subtree location
-        ((int***)branches)[i] = head;
+        branches[i] = head;
         for (int j = 0; j <= i; j++) {
-            //Set branch location
-            head[j] = tail;
-            tail += sizer(len, layers, j);
+            //Set branch location, leaving out layers a compact tree does not store
+            head[j] = stored(i, j) ? tail : NULL;
+            tail += stored(i, j) ? sizer(len, layers, j) : 0;
         }
         head += i + 1;
     }
 
-    ///Initialize state values
-
-    //Loop through every class
-    long* queue = start + initial;
-    long* tails = (void*)queue + (int)sizeof(long) * layers;
-    for (int class = 0; class < layers; class++) {
-        //Initialize lists to empty
-        queue[class] = -1;
-        tails[class] = -1;
-        int** trunk = ((int***)branches)[class];
-        for (int layer = 0; layer <= class; layer++) {
-            int* branch = trunk[layer];
-            //Set all branch states to zero
-            int width = sizer(len, layers, layer);
-            for (int k = 0; k < width; branch[k++] = 0);
-        }
+    //Initialize the lock, process-shared so that the region itself may live in shared memory
+    pthread_mutex_t* mutex = start + at.latch;
+    if (latch) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutex_init(mutex, &attr);
+        pthread_mutexattr_destroy(&attr);
     }
 
-    //Initialize allocation flags
+    //Final tail value, rounded up to the minimum block size so that every block meets malloc's alignment, becomes
+    //allocation base
     char* alloc = start;
-    for (int index = 0; index < allocs; index++) {
-        alloc[index] = 0;
-    }
-
-    //Final tail value becomes allocation base
-    tree->base = tail;
+    tree->base = (void*) (((uintptr_t) tail + MINIMUM - 1) / MINIMUM * MINIMUM);
     tree->end = start + len;
     tree->branches = branches;
     tree->layers = layers;
-    tree->stack = queue;
-    tree->tails = tails;
+    tree->stack = start + at.initial;
+    tree->tails = start + at.initial + (long)sizeof(long) * layers;
+    tree->held = start + at.initial + (long)sizeof(long) * 2 * layers;
+    tree->hold = start + at.initial + (long)sizeof(long) * 3 * layers;
+    tree->available = start + at.initial + (long)sizeof(long) * 4 * layers;
     tree->alloc = alloc;
+    tree->coarse = alloc + seg(at.allocs, 2);
+    tree->mutex = mutex;
     tree->len = len;
+    tree->segments = (long)(tree->end - tree->base) / MINIMUM;
+    tree->splits = 0;
+    tree->merges = 0;
+}
+
+/**
+ * Empties the class stacks and lays the initial free blocks out over bitmaps and marks that are all zero
+ * @param tree tree pointer
+ */
+static void lay(PearTree* tree) {
+    int layers = tree->layers;
+
+    //Initialize lists to empty
+    for (int class = 0; class < layers; class++) {
+        tree->stack[class] = -1;
+        tree->tails[class] = -1;
+        tree->held[class] = 0;
+    }
 
     //Initialize reachable branch remnants through greedy change-making
-    long rem = (int)(tree->end - tree->base);
-    tree->segments = rem / MINIMUM;
+    *tree->available = 0;
+    long rem = (long)(tree->end - tree->base);
     if (debug) printf("Segments: %ld\n", rem / MINIMUM);
     long offset = 0;
     if (debug) printf("Class: ");
     for (int class = 0; class < layers; class++) {
         //Determine if class block size will fit
-        int size = block(layers, class);
+        long size = block(layers, class);
         if (size <= rem) {
             long index = offset / size;
-            if (debug) printf("%d - %d - %ld, ", class, block(layers, class), index);
-            for (int layer = class; layer >= 0; layer--) {
+            if (debug) printf("%d - %ld - %ld, ", class, block(layers, class), index);
+            for (int layer = class; layer >= 0; layer = rise(layer)) {
                 //Set tree edges appropriately
                 set(tree, class, layer, index);
-                index = parent(index);
+                index >>= layer - rise(layer);
             }
+            *tree->available |= 1ULL << class;
             rem -= size;
             offset += size;
         }
@@ -142,6 +281,72 @@ void init(PearTree* tree, void* start, long len) {
     if (debug) printf("\n");
 }
 
+/**
+ * Initializes a peartree
+ * @param tree tree pointer
+ * @param start pointer to the beginning of the memory block
+ * @param len bytes in the memory block
+ * @param zero whether the metadata must be cleared, or is known to be zero already
+ */
+static void build(PearTree* tree, void* start, long len, bool zero) {
+    frame(tree, start, len, NULL, true);
+    int layers = tree->layers;
+
+    ///Initialize state values
+
+    //Loop through every class
+    for (int class = 0; class < layers; class++) {
+        tree->hold[class] = 0;
+        uint64_t** trunk = tree->branches[class];
+        for (int layer = 0; layer <= class; layer++) {
+            uint64_t* branch = trunk[layer];
+            if (branch == NULL || !zero) {
+                continue;
+            }
+            //Set all branch states to zero
+            long width = sizer(len, layers, layer);
+            for (long k = 0; k < width; branch[k++] = 0);
+        }
+    }
+
+    //Initialize allocation flags
+    for (long index = 0; zero && index < marks(len / MINIMUM); index++) {
+        tree->alloc[index] = 0;
+    }
+
+    lay(tree);
+}
+
+void init(PearTree* tree, void* start, long len) {
+    build(tree, start, len, true);
+}
+
+void adopt(PearTree* tree, void* start, long len) {
+    build(tree, start, len, false);
+}
+
+void reset(PearTree* tree) {
+    Layout at = plan(tree->len);
+
+    //The marks lead the state region and the bitmaps trail it, the lock and branch tables between them are kept
+    memset(tree->alloc, 0, (size_t)at.initial);
+    memset(tree->alloc + at.overhead, 0, (size_t)((char*)tree->base - (tree->alloc + at.overhead)));
+    lay(tree);
+}
+
+void reopen(PearTree* tree, void* start, long len) {
+    frame(tree, start, len, NULL, true);
+}
+
+long tables(long len) {
+    Layout at = plan(len);
+    return at.overhead - at.begin;
+}
+
+void attach(PearTree* tree, void* start, long len, void* tables) {
+    frame(tree, start, len, tables, false);
+}
+
 /**
  * Pops a node from the relevant class stacks
  * @param tree peartree pointer
@@ -151,7 +356,7 @@ void init(PearTree* tree, void* start, long len) {
 long pop(PearTree* tree, int class) {
     if (!SPLICE) {
         long index = tree->stack[class];
-        if (tree->alloc[ialloc(tree, class, index)] != ~class) {
+        if (mark(tree, ialloc(tree, class, index)) != ~class) {
             tree->stack[class] = -1;
             return -1;
         }
@@ -161,7 +366,12 @@ long pop(PearTree* tree, int class) {
     long index = tree->stack[class];
     long next = ((SignPost*)locate(tree, class, index))->next;
     tree->stack[class] = next;
-    tree->alloc[ialloc(tree, class, index)] = 0;
+    stamp(tree, ialloc(tree, class, index), 0);
+
+    //A block whose buddy is free is one whose merge was put off, and taking it undoes the need for it
+    if (tree->held[class] > 0 && class > 0 && value(tree, class, class, index ^ 1)) {
+        tree->held[class]--;
+    }
 
     //Set tail to none if only node
     if (tree->tails[class] == index) {
@@ -180,8 +390,14 @@ long pop(PearTree* tree, int class) {
 void push(PearTree* tree, int class, long index) {
     //Retrieve the current list head and set its prev to the new node
     long old = tree->stack[class];
-    ((SignPost*)locate(tree, class, old))->prev = index;
-    tree->alloc[ialloc(tree, class, index)] = ~((char)class);
+    if (old >= 0 && mark(tree, ialloc(tree, class, old)) != ~class) {
+        //A stale head may already be handed out again, and pop would discard the stack behind it anyway
+        old = -1;
+    }
+    if (old >= 0) {
+        ((SignPost*)locate(tree, class, old))->prev = index;
+    }
+    stamp(tree, ialloc(tree, class, index), ~((char)class));
 
     //Set new list head and new node's neighbors
     tree->stack[class] = index;
@@ -203,12 +419,12 @@ void push(PearTree* tree, int class, long index) {
  */
 void delete(PearTree* tree, int class, long index) {
     if (SPLICE) {
-        if (tree->alloc[ialloc(tree, class, index)] == ~class) {
+        if (mark(tree, ialloc(tree, class, index)) == ~class) {
             //Calculate addresses of node and neighbors
             SignPost* post = locate(tree, class, index);
             SignPost* next = locate(tree, class, post->next);
             SignPost* prev = locate(tree, class, post->prev);
-            tree->alloc[ialloc(tree, class, index)] = 0;
+            stamp(tree, ialloc(tree, class, index), 0);
 
             //Set list heads and tails if appropriate
             if (tree->stack[class] == index) {
@@ -221,7 +437,7 @@ void delete(PearTree* tree, int class, long index) {
 
             //Reset next's attributes if it exists
             if ((void*)next >= tree->base && (void*)next < tree->end) {
-                if (tree->alloc[ialloc(tree, class, post->next)] == ~class) {
+                if (mark(tree, ialloc(tree, class, post->next)) == ~class) {
                     if (next->prev == index) {
                         next->prev = post->prev;
                     }
@@ -230,7 +446,7 @@ void delete(PearTree* tree, int class, long index) {
 
             //Reset prev's attributes if it exists
             if ((void*)prev >= tree->base && (void*)prev < tree->end) {
-                if (tree->alloc[ialloc(tree, class, post->prev)] == ~class) {
+                if (mark(tree, ialloc(tree, class, post->prev)) == ~class) {
                     if (prev->next == index) {
                         prev->next = post->next;
                     }
@@ -239,7 +455,7 @@ void delete(PearTree* tree, int class, long index) {
         }
     }
     else {
-        tree->alloc[ialloc(tree, class, index)] = 0;
+        stamp(tree, ialloc(tree, class, index), 0);
     }
 }
 
@@ -252,9 +468,15 @@ void delete(PearTree* tree, int class, long index) {
 void prograte(PearTree* tree, int class, long index) {
     if (debug) printf("Prograting %d %ld\n", class, index);
     //While the node's parent is zero, set it to one and continue propagating up
-    for (int layer = class; layer >= 0; layer--) {
+    int layer = class;
+    for (; layer >= 0 && !value(tree, class, layer, index); layer = rise(layer)) {
         set(tree, class, layer, index);
-        index = parent(index);
+        index >>= layer - rise(layer);
+    }
+
+    //Setting the root means the class had no free block before
+    if (layer < 0) {
+        *tree->available |= 1ULL << class;
     }
 }
 
@@ -267,12 +489,22 @@ void prograte(PearTree* tree, int class, long index) {
 void antigrate(PearTree* tree, int class, long index) {
     //Set given node to zero
     unset(tree, class, class, index);
-    index = parent(index);
 
-    //While the node and its sibling are both zero, set parent to zero and continue propogating up
-    for (int layer = class - 1; layer >= 0 && !pear(tree, class, layer, index); layer--) {
-        unset(tree, class, layer, index);
-        index = parent(index);
+    //While the node and its siblings are all zero, set parent to zero and continue propogating up
+    int layer = class;
+    while (layer > 0) {
+        int up = rise(layer);
+        index >>= layer - up;
+        if (brood(tree, class, layer, index, layer - up)) {
+            break;
+        }
+        unset(tree, class, up, index);
+        layer = up;
+    }
+
+    //Clearing the root means the class has no free block left
+    if (layer == 0) {
+        *tree->available &= ~(1ULL << class);
     }
 }
 
@@ -284,6 +516,7 @@ void antigrate(PearTree* tree, int class, long index) {
  */
 void merge(PearTree* tree, int class, long index) {
     if (debug) printf("Merging %d %ld\n", class, index);
+    tree->merges++;
     //Antigrate the child nodes in the lower class and propagate the given node and class
     unset(tree, class + 1, class + 1, child(index) + 1);
     antigrate(tree, class + 1, child(index));
@@ -291,18 +524,25 @@ void merge(PearTree* tree, int class, long index) {
 }
 
 /**
- * Splits a given node into a lower class
+ * Splits a given node down to a lower class in a single pass, freeing the leading half at every level
  * @param tree peartree pointer
- * @param class size class
+ * @param class size class of the node
  * @param index node index
+ * @param target size class to split down to
+ * @return index of the trailing block of the target class, which is left neither free nor marked
  */
-void split(PearTree* tree, int class, long index) {
-    if (debug) printf("Splitting %d %ld\n", class, index);
-    //Antigrate given node and propagate children in lower class
+long split(PearTree* tree, int class, long index, int target) {
+    if (debug) printf("Splitting %d %ld down to %d\n", class, index, target);
+    tree->splits += target - class;
     delete(tree, class, index);
     antigrate(tree, class, index);
-    prograte(tree, class + 1, child(index));
-    set(tree, class + 1, class + 1, child(index) + 1);
+
+    //The trailing half is split again straight away, so only the leading halves are ever marked free
+    for (; class < target; class++) {
+        prograte(tree, class + 1, child(index));
+        index = child(index) + 1;
+    }
+    return index;
 }
 
 /**
@@ -314,36 +554,40 @@ void split(PearTree* tree, int class, long index) {
 long descend(PearTree* tree, int class, bool initial) {
     //If a node exists in the stack, use it
     if (tree->stack[class] >= 0 && QUEUE) {
-        return pop(tree, class);
+        long index = pop(tree, class);
+        if (index >= 0) {
+            return index;
+        }
     }
 
-    //If the tree is empty, descend and split
-    else if (!tree->branches[class][0][0]) {
-        //Unsuccessful base case at top class
-        if (class == 0) {
+    //If the tree is empty, jump to the nearest larger class with a free block and split one down
+    if (!tree->branches[class][0][0]) {
+        uint64_t larger = *tree->available & ((1ULL << class) - 1);
+        if (!larger) {
             return -1;
         }
-        //Descend in the higher class and split the node found
-        long parent = descend(tree, class - 1, false);
-        if (parent < 0) {
-            return -1;
-        }
-        split(tree, class - 1, parent);
-        return child(parent) + 1;
+        int nearest = WORDSIZE - 1 - __builtin_clzll(larger);
+        return split(tree, nearest, descend(tree, nearest, false), class);
     }
 
-    //If not empty, traverse the tree
+    //If not empty, traverse the tree, leftmost first for requests and rightmost first for splits
     else {
+        //The descendants of a node STRIDE layers down fill exactly one word, so each word acts as a
+        //summary pointing straight at the non-empty regions below it and a single scan skips STRIDE layers
         long index = 0;
-        if (initial) {
-            for (int layer = 0; layer < class; layer++) {
-                index = 2 * index + !value(tree, class, layer + 1, child(index));
-            }
+        int layer = 0;
+        for (; layer + STRIDE <= class; layer += STRIDE) {
+            uint64_t word = tree->branches[class][layer + STRIDE][index];
+            index = (index << STRIDE) + scan(word, initial);
         }
-        else {
-            for (int layer = 0; layer < class; layer++) {
-                index = 2 * index + (value(tree, class, layer + 1, child(index) + 1) ? 1 : 0);
-            }
+
+        //Finish the remaining layers inside the part of a single word under the current node
+        int rest = class - layer;
+        if (rest > 0) {
+            long first = index << rest;
+            uint64_t word = tree->branches[class][class][first / WORDSIZE] >> (first % WORDSIZE);
+            word &= (1ULL << (1 << rest)) - 1;
+            index = first + scan(word, initial);
         }
 
         return index;
@@ -357,8 +601,16 @@ long descend(PearTree* tree, int class, bool initial) {
  * @param index node index
  */
 void ascend(PearTree* tree, int class, long index, bool initial) {
+    bool paired = class > 0 && pear(tree, class, class - 1, parent(index)) == 3;
+
+    //Put the merge off while the class is under its watermark, queueing the block like any other
+    if (paired && initial && QUEUE && tree->held[class] < tree->hold[class]) {
+        tree->held[class]++;
+        push(tree, class, index);
+    }
+
     //If not already in the highest class and the sibling is one, merge and ascend
-    if (class > 0 && pear(tree, class, class - 1, parent(index)) == 3) {
+    else if (paired) {
         //Delete merged nodes from the list
         delete(tree, class, child(parent(index)));
         delete(tree, class, child(parent(index)) + 1);
@@ -372,28 +624,228 @@ void ascend(PearTree* tree, int class, long index, bool initial) {
     }
 }
 
+/**
+ * Completes the merges put off by classes under their watermarks
+ * @param tree peartree pointer
+ * @param all whether to sweep every class, rather than only those that put merges off
+ * @return number of buddy pairs merged
+ */
+static long settle(PearTree* tree, bool all) {
+    long merged = 0;
+    for (int class = tree->layers - 1; class > 0; class--) {
+        if (!all && tree->held[class] == 0) {
+            continue;
+        }
+        tree->held[class] = 0;
+        uint64_t* branch = tree->branches[class][class];
+        long width = sizer(tree->len, tree->layers, class);
+        for (long k = 0; k < width; k++) {
+            //Buddies share a word, a set even bit followed by a set odd bit is a free pair
+            for (uint64_t pairs = branch[k] & (branch[k] >> 1) & 0x5555555555555555ULL; pairs; pairs &= pairs - 1) {
+                long index = k * WORDSIZE + __builtin_ctzll(pairs);
+                delete(tree, class, index);
+                delete(tree, class, index + 1);
+                merge(tree, class - 1, parent(index));
+                ascend(tree, class - 1, parent(index), false);
+                merged++;
+            }
+        }
+    }
+    return merged;
+}
+
+int classify(PearTree* tree, long size) {
+    if (size > block(tree->layers, 0)) {
+        return -1;
+    }
+
+    //Count the doublings of the minimum block needed to fit the request
+    int rank = size <= MINIMUM ? 0 : 64 - __builtin_clzl((size - 1) / MINIMUM);
+    return tree->layers - 1 - rank;
+}
+
 void* take(PearTree* tree, long size) {
     //If the request isn't satisfiable, return null
-    if (size > block(tree->layers, 0)) {
+    int class = classify(tree, size);
+    if (class < 0) {
         return NULL;
     }
 
-    //Determine the size class
-    int class;
-    for (class = tree->layers - 1; size > block(tree->layers, class); class--);
-
-    //Descend and validate the index
+    //Descend and validate the index, merges put off may be all that keeps a large enough block from forming
     long index = descend(tree, class, true);
+    if (index < 0 && settle(tree, false)) {
+        index = descend(tree, class, true);
+    }
     if (index < 0) {
         return NULL;
     }
 
     //Antigrate the given index and allocate
     antigrate(tree, class, index);
-    tree->alloc[ialloc(tree, class, index)] = (char)(class + 1);
+    stamp(tree, ialloc(tree, class, index), (char)(class + 1));
     return locate(tree, class, index);
 }
 
+int take_many(PearTree* tree, long size, void** out, int n) {
+    int class = classify(tree, size);
+    if (class < 0) {
+        return 0;
+    }
+    int got = 0;
+
+    //Reuse queued blocks of the class first, they are the most recently freed
+    while (QUEUE && got < n && tree->stack[class] >= 0) {
+        long index = pop(tree, class);
+        if (index < 0) {
+            break;
+        }
+        antigrate(tree, class, index);
+        stamp(tree, ialloc(tree, class, index), (char)(class + 1));
+        out[got++] = locate(tree, class, index);
+    }
+
+    while (got < n) {
+        //Aim for a single block holding every remaining request, settling for smaller ones when there is none
+        int span = n - got > 1 ? 64 - __builtin_clzl((unsigned long)(n - got - 1)) : 0;
+        span = span < class ? span : class;
+        long index = descend(tree, class - span, true);
+        while (index < 0 && span > 0) {
+            index = descend(tree, class - --span, true);
+        }
+        if (index < 0 && settle(tree, false)) {
+            index = descend(tree, class - span, true);
+        }
+        if (index < 0) {
+            break;
+        }
+        antigrate(tree, class - span, index);
+
+        //Hand out its leading blocks without touching the bitmaps again
+        long first = index << span;
+        long count = 1L << span;
+        long taken = count < n - got ? count : n - got;
+        for (long i = first; i < first + taken; i++) {
+            stamp(tree, ialloc(tree, class, i), (char)(class + 1));
+            out[got++] = locate(tree, class, i);
+        }
+
+        //Free the rest as the few aligned blocks it is made of, none of which can merge with its buddy
+        for (long offset = taken; offset < count; offset += offset & -offset) {
+            int up = __builtin_ctzl(offset);
+            prograte(tree, class - up, (first + offset) >> up);
+            if (QUEUE) {
+                push(tree, class - up, (first + offset) >> up);
+            }
+        }
+    }
+    return got;
+}
+
+/**
+ * Orders pointers by address
+ */
+static int order(const void* a, const void* b) {
+    uintptr_t x = (uintptr_t) *(void* const*) a;
+    uintptr_t y = (uintptr_t) *(void* const*) b;
+    return (x > y) - (x < y);
+}
+
+void give_many(PearTree* tree, void** pointers, int n) {
+    qsort(pointers, n, sizeof(void*), order);
+    for (int i = 0; i < n;) {
+        int class = pointers[i] ? mark(tree, (pointers[i] - tree->base) / MINIMUM) - 1 : -1;
+        if (class < 0) {
+            i++;
+            continue;
+        }
+        long index = (pointers[i] - tree->base) / block(tree->layers, class);
+
+        //Double the run while the next as many pointers are the neighbouring blocks completing an aligned pair
+        int span = 0;
+        while (span < class && index % (2L << span) == 0 && i + (2L << span) <= n) {
+            long j = 1L << span;
+            for (; j < 2L << span; j++) {
+                long neighbour = index + j;
+                if (pointers[i + j] != locate(tree, class, neighbour)
+                    || mark(tree, ialloc(tree, class, neighbour)) != class + 1) {
+                    break;
+                }
+            }
+            if (j < 2L << span) {
+                break;
+            }
+            span++;
+        }
+
+        //Free the run as one block of a larger class, merging it with its buddies as give would
+        long run = 1L << span;
+        for (long j = index; j < index + run; j++) {
+            stamp(tree, ialloc(tree, class, j), 0);
+        }
+        prograte(tree, class - span, index >> span);
+        ascend(tree, class - span, index >> span, true);
+        i += (int) run;
+    }
+}
+
+void give_sized(PearTree* tree, void* pointer, long size) {
+    if (pointer == NULL) {
+        return;
+    }
+
+    //The class follows from the size, only the mark needs clearing
+    int class = classify(tree, size);
+    long index = (pointer - tree->base) / block(tree->layers, class);
+    stamp(tree, ialloc(tree, class, index), 0);
+    prograte(tree, class, index);
+    ascend(tree, class, index, true);
+}
+
+bool expand(PearTree* tree, void* pointer, long size) {
+    int class = mark(tree, (pointer - tree->base) / MINIMUM) - 1;
+    int target = classify(tree, size);
+    if (class < 0 || target < 0 || target > class) {
+        return false;
+    }
+    long index = (pointer - tree->base) / block(tree->layers, class);
+
+    //The block must lead every larger block up to the target, and each of their buddies must be free whole
+    for (int up = class; up > target; up--) {
+        long node = index >> (class - up);
+        if (node % 2 || !value(tree, up, up, node + 1)) {
+            return false;
+        }
+    }
+
+    //Claim the buddies, the mark stays on the same minimum block and only changes class
+    for (int up = class; up > target; up--) {
+        long buddy = (index >> (class - up)) + 1;
+        delete(tree, up, buddy);
+        antigrate(tree, up, buddy);
+    }
+    stamp(tree, ialloc(tree, class, index), (char)(target + 1));
+    return true;
+}
+
+void shrink(PearTree* tree, void* pointer, long size) {
+    int class = mark(tree, (pointer - tree->base) / MINIMUM) - 1;
+    int target = classify(tree, size);
+    if (class < 0 || target <= class) {
+        return;
+    }
+    long index = (pointer - tree->base) / block(tree->layers, class);
+
+    //Free the trailing half at every split, none of which can merge while the leading half is held
+    for (int down = class + 1; down <= target; down++) {
+        long buddy = (index << (down - class)) + 1;
+        prograte(tree, down, buddy);
+        if (QUEUE) {
+            push(tree, down, buddy);
+        }
+    }
+    stamp(tree, ialloc(tree, class, index), (char)(target + 1));
+}
+
 void give(PearTree* tree, void* pointer) {
     //Guard against freeing null memory
     if (pointer == NULL) {
@@ -404,16 +856,440 @@ void give(PearTree* tree, void* pointer) {
     long rindex = (pointer - tree->base) / MINIMUM;
 
     //If block was previously allocated
-    int class = tree->alloc[rindex] - 1;
-    if (class > 0) {
+    int class = mark(tree, rindex) - 1;
+    if (class >= 0) {
         //Calculate true classed index, deallocate, prograte change up tree, and ascend
         long index = (pointer - tree->base) / block(tree->layers, class);
-        tree->alloc[ialloc(tree, class, index)] = 0;
+        stamp(tree, ialloc(tree, class, index), 0);
         prograte(tree, class, index);
         ascend(tree, class, index, true);
     }
 }
 
+void defer(PearTree* tree, int level, long limit) {
+    if (level >= 0 && level < tree->layers) {
+        tree->hold[level] = limit > 0 ? limit : 0;
+    }
+}
+
+long coalesce(PearTree* tree) {
+    return settle(tree, true);
+}
+
+long measure(PearTree* tree, void* pointer) {
+    int class = mark(tree, (pointer - tree->base) / MINIMUM) - 1;
+    return class >= 0 ? block(tree->layers, class) : 0;
+}
+
+bool verify(PearTree* tree) {
+    int layers = tree->layers;
+    long free = 0;
+
+    //Walk the heap block by block, each granule must start an allocated block or the largest free one there
+    for (long granule = 0; granule < tree->segments;) {
+        int found = mark(tree, granule);
+        int class = found > 0 ? found - 1 : -1;
+        for (int c = 0; class < 0 && c < layers; c++) {
+            long span = block(layers, c) / MINIMUM;
+            if (granule % span == 0 && value(tree, c, c, granule / span)) {
+                class = c;
+            }
+        }
+        if (class < 0 || (found < 0 && found != ~class)) {
+            return false;
+        }
+        long span = block(layers, class) / MINIMUM;
+        if (granule % span || granule + span > tree->segments) {
+            return false;
+        }
+        if (found > 0 && value(tree, class, class, granule / span)) {
+            return false;
+        }
+        for (long inner = granule + 1; inner < granule + span; inner++) {
+            if (mark(tree, inner)) {
+                return false;
+            }
+        }
+        free += found > 0 ? 0 : span;
+        granule += span;
+    }
+
+    for (int class = 0; class < layers; class++) {
+        //Free blocks are counted once, so no class may hold a bit the walk did not visit
+        uint64_t* branch = tree->branches[class][class];
+        long width = sizer(tree->len, layers, class);
+        for (long k = 0; k < width; k++) {
+            free -= __builtin_popcountll(branch[k]) * (block(layers, class) / MINIMUM);
+        }
+
+        //Every stored layer must summarize the one below it
+        for (int layer = class; layer > 0; layer = rise(layer)) {
+            int up = rise(layer);
+            long nodes = seg(tree->len, block(layers, up));
+            for (long index = 0; index < nodes; index++) {
+                if (!value(tree, class, up, index) != !brood(tree, class, layer, index, layer - up)) {
+                    return false;
+                }
+            }
+        }
+
+        long count = tree->segments / (block(layers, class) / MINIMUM);
+        if (tree->stack[class] < -1 || tree->stack[class] >= count
+            || tree->tails[class] < -1 || tree->tails[class] >= count
+            || tree->held[class] < 0 || tree->hold[class] < 0
+            || !(*tree->available & 1ULL << class) != !tree->branches[class][0][0]) {
+            return false;
+        }
+    }
+    return free == 0;
+}
+
+long trim(PearTree* tree, long page, int advice) {
+    long released = 0;
+    for (int class = 0; class < tree->layers && block(tree->layers, class) >= page; class++) {
+        //Every set bit at the bottom of a class tree is a free block that could not merge any further
+        uint64_t* branch = tree->branches[class][class];
+        long width = sizer(tree->len, tree->layers, class);
+        for (long k = 0; k < width; k++) {
+            for (uint64_t word = branch[k]; word; word &= word - 1) {
+                long index = k * WORDSIZE + __builtin_ctzll(word);
+                uintptr_t start = (uintptr_t) locate(tree, class, index);
+                uintptr_t end = start + block(tree->layers, class);
+                if (mark(tree, ialloc(tree, class, index)) == ~class) {
+                    start += sizeof(SignPost);
+                }
+
+                //Only whole pages inside the block can be released
+                start = (start + page - 1) / page * page;
+                end = end / page * page;
+                if (end > start) {
+                    if (madvise((void*) start, end - start, advice) != 0) {
+                        madvise((void*) start, end - start, MADV_DONTNEED);
+                    }
+                    released += (long) (end - start);
+                }
+            }
+        }
+    }
+    return released;
+}
+
+double overhead(PearTree* tree) {
+    return (double)(tree->base - (void*)tree->alloc) / (double)(tree->end - tree->base);
+}
+
+void share(PearTree* tree) {
+    //Robust locks cost a little more to take, so only trees used by several processes get one
+    pthread_mutexattr_t attr;
+    pthread_mutexattr_init(&attr);
+    pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+    pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+    pthread_mutex_init(tree->mutex, &attr);
+    pthread_mutexattr_destroy(&attr);
+}
+
+bool lock(PearTree* tree) {
+    //The previous holder died, possibly halfway through an operation, and the lock passed to us
+    if (pthread_mutex_lock(tree->mutex) == EOWNERDEAD) {
+        pthread_mutex_consistent(tree->mutex);
+        return false;
+    }
+    return true;
+}
+
+void unlock(PearTree* tree) {
+    pthread_mutex_unlock(tree->mutex);
+}
+
+//Bits of a lock-free stack head holding the index of its top block plus one, the rest count pushes and pops
+#define HEADBITS 40
+
+//Shorthands for sequentially consistent atomic operations on plain words
+#define load(word) __atomic_load_n(word, __ATOMIC_SEQ_CST)
+#define fetch_or(word, bits) __atomic_fetch_or(word, bits, __ATOMIC_SEQ_CST)
+#define fetch_and(word, bits) __atomic_fetch_and(word, bits, __ATOMIC_SEQ_CST)
+#define swap(word, expected, desired) \
+    __atomic_compare_exchange_n(word, expected, desired, false, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)
+
+/**
+ * Brings the summary bit above a node in line with the nodes it covers. Every write is followed by another
+ * look at those nodes, so whichever thread writes the bit last leaves it agreeing with them.
+ * @param tree peartree pointer
+ * @param class size class
+ * @param layer stored layer of the node, above zero
+ * @param index node index
+ * @return whether this thread wrote the bit, in which case the layer above needs reconciling in turn
+ */
+static bool reconcile(PearTree* tree, int class, int layer, long index) {
+    int up = rise(layer);
+    int span = layer - up;
+    long node = index >> span;
+    long first = node << span;
+    uint64_t* below = &tree->branches[class][layer][first / WORDSIZE];
+    uint64_t* above = &tree->branches[class][up][node / WORDSIZE];
+    uint64_t mask = span == STRIDE ? ~0ULL : (1ULL << (1 << span)) - 1;
+    uint64_t bit = 1ULL << (node % WORDSIZE);
+    bool wrote = false;
+    for (;;) {
+        bool free = (load(below) >> (first % WORDSIZE) & mask) != 0;
+        if (free == ((load(above) & bit) != 0)) {
+            return wrote;
+        }
+        if (free) {
+            fetch_or(above, bit);
+        }
+        else {
+            fetch_and(above, ~bit);
+        }
+        wrote = true;
+    }
+}
+
+/**
+ * Reconciles the summaries above a node whose bit changed, up to the class's bit in the availability word
+ * @param tree peartree pointer
+ * @param class size class
+ * @param layer stored layer of the node
+ * @param index node index
+ */
+static void propagate(PearTree* tree, int class, int layer, long index) {
+    for (; layer > 0; layer = rise(layer)) {
+        if (!reconcile(tree, class, layer, index)) {
+            return;
+        }
+        index >>= layer - rise(layer);
+    }
+    for (uint64_t bit = 1ULL << class;;) {
+        bool free = load(&tree->branches[class][0][0]) != 0;
+        if (free == ((load(tree->available) & bit) != 0)) {
+            return;
+        }
+        if (free) {
+            fetch_or(tree->available, bit);
+        }
+        else {
+            fetch_and(tree->available, ~bit);
+        }
+    }
+}
+
+/**
+ * Claims a free block by clearing its bit
+ * @param tree peartree pointer
+ * @param class size class
+ * @param index node index
+ * @return whether the block was free and now belongs to the caller
+ */
+static bool claim(PearTree* tree, int class, long index) {
+    uint64_t bit = 1ULL << (index % WORDSIZE);
+    if (!(fetch_and(&tree->branches[class][class][index / WORDSIZE], ~bit) & bit)) {
+        return false;
+    }
+    propagate(tree, class, class, index);
+    return true;
+}
+
+/**
+ * Claims a block and its buddy together, if both are free
+ * @param tree peartree pointer
+ * @param class size class
+ * @param index node index of either buddy
+ * @return whether both were free and their parent now belongs to the caller
+ */
+static bool claim_pair(PearTree* tree, int class, long index) {
+    uint64_t* word = &tree->branches[class][class][index / WORDSIZE];
+    uint64_t pair = 3ULL << (index / 2 * 2 % WORDSIZE);
+    uint64_t old = load(word);
+    do {
+        if ((old & pair) != pair) {
+            return false;
+        }
+    } while (!swap(word, &old, old & ~pair));
+    propagate(tree, class, class, index);
+    return true;
+}
+
+/**
+ * Marks a block free and reconciles the summaries above it
+ * @param tree peartree pointer
+ * @param class size class
+ * @param index node index
+ */
+static void publish(PearTree* tree, int class, long index) {
+    fetch_or(&tree->branches[class][class][index / WORDSIZE], 1ULL << (index % WORDSIZE));
+    propagate(tree, class, class, index);
+}
+
+/**
+ * Pushes a block onto a class stack. The block must not be free yet, its link is written on every attempt.
+ * @param tree peartree pointer
+ * @param class size class
+ * @param index node index
+ */
+static void push_lockfree(PearTree* tree, int class, long index) {
+    uint64_t* head = (uint64_t*) &tree->stack[class];
+    long count = tree->segments / (block(tree->layers, class) / MINIMUM);
+    SignPost* post = (SignPost*) locate(tree, class, index);
+    uint64_t old = load(head);
+    uint64_t fresh;
+    do {
+        long top = (long) (old & ((1ULL << HEADBITS) - 1)) - 1;
+        post->next = top < count ? top : -1;
+        fresh = ((old >> HEADBITS) + 1) << HEADBITS | (uint64_t) (index + 1);
+    } while (!swap(head, &old, fresh));
+}
+
+/**
+ * Pops the top block of a class stack. The tag in the head makes the swap fail if the stack changed at all
+ * since the head was read, so a link read from a block that was handed out meanwhile is never installed.
+ * @param tree peartree pointer
+ * @param class size class
+ * @return index of a block that was pushed, which is only free if claiming it succeeds, or -1 if empty
+ */
+static long pop_lockfree(PearTree* tree, int class) {
+    uint64_t* head = (uint64_t*) &tree->stack[class];
+    long count = tree->segments / (block(tree->layers, class) / MINIMUM);
+    uint64_t old = load(head);
+    for (;;) {
+        long top = (long) (old & ((1ULL << HEADBITS) - 1)) - 1;
+        if (top < 0 || top >= count) {
+            return -1;
+        }
+        long next = __atomic_load_n(&((SignPost*) locate(tree, class, top))->next, __ATOMIC_RELAXED);
+        uint64_t fresh = ((old >> HEADBITS) + 1) << HEADBITS | (uint64_t) (next >= 0 && next < count ? next + 1 : 0);
+        if (swap(head, &old, fresh)) {
+            return top;
+        }
+    }
+}
+
+/**
+ * Finds a free block in a class tree by following its summaries, which may be stale
+ * @param tree peartree pointer
+ * @param class size class
+ * @param initial leftmost first for requests, rightmost first for splits
+ * @return index of a block that was free when found, or -1 if the class has none
+ */
+static long find(PearTree* tree, int class, bool initial) {
+    for (;;) {
+        if (!load(&tree->branches[class][0][0])) {
+            return -1;
+        }
+
+        long index = 0;
+        int layer = 0;
+        uint64_t word = 1;
+        for (; word && layer + STRIDE <= class; layer += STRIDE) {
+            word = load(&tree->branches[class][layer + STRIDE][index]);
+            index = (index << STRIDE) + (word ? scan(word, initial) : 0);
+        }
+        if (word && layer < class) {
+            long first = index << (class - layer);
+            word = load(&tree->branches[class][class][first / WORDSIZE]) >> (first % WORDSIZE);
+            word &= (1ULL << (1 << (class - layer))) - 1;
+            index = first + (word ? scan(word, initial) : 0);
+            layer = class;
+        }
+        if (word) {
+            return index;
+        }
+
+        //A summary found empty was left by a thread yet to reconcile it, which may not run again for a while,
+        //so fix it rather than wait for it and start over from the root
+        propagate(tree, class, layer, index);
+    }
+}
+
+/**
+ * Claims a free block of a class, splitting one of the nearest larger class with a free block if it has none
+ * @param tree peartree pointer
+ * @param class size class
+ * @param initial leftmost first for requests, rightmost first for splits
+ * @return index of the claimed block, or -1 if there is no free block large enough
+ */
+static long seize(PearTree* tree, int class, bool initial) {
+    for (;;) {
+        //A block popped that cannot be claimed was handed out since, and the links behind it are not trusted
+        long index = QUEUE ? pop_lockfree(tree, class) : -1;
+        if (index >= 0) {
+            if (claim(tree, class, index)) {
+                return index;
+            }
+            uint64_t* head = (uint64_t*) &tree->stack[class];
+            for (uint64_t old = load(head); !swap(head, &old, ((old >> HEADBITS) + 1) << HEADBITS););
+        }
+
+        index = find(tree, class, initial);
+        if (index >= 0) {
+            if (claim(tree, class, index)) {
+                return index;
+            }
+            continue;
+        }
+
+        uint64_t larger = load(tree->available) & ((1ULL << class) - 1);
+        if (!larger) {
+            return -1;
+        }
+        int nearest = WORDSIZE - 1 - __builtin_clzll(larger);
+        long parent = seize(tree, nearest, false);
+        if (parent < 0) {
+            propagate(tree, nearest, 0, 0);
+            continue;
+        }
+
+        //Free the leading half at every level, the trailing half is the caller's alone and split further
+        __atomic_fetch_add(&tree->splits, class - nearest, __ATOMIC_RELAXED);
+        for (int level = nearest; level < class; level++) {
+            publish(tree, level + 1, child(parent));
+            parent = child(parent) + 1;
+        }
+        return parent;
+    }
+}
+
+void* take_lockfree(PearTree* tree, long size) {
+    int class = classify(tree, size);
+    long index = class < 0 ? -1 : seize(tree, class, true);
+    return index < 0 ? NULL : locate(tree, class, index);
+}
+
+void give_lockfree(PearTree* tree, void* pointer, long size) {
+    if (pointer == NULL) {
+        return;
+    }
+    int class = classify(tree, size);
+    long index = (pointer - tree->base) / block(tree->layers, class);
+    for (bool initial = true;; initial = false) {
+        //A free buddy claimed makes the parent the caller's, with no need to publish the block at all
+        if (class > 0 && claim(tree, class, index ^ 1)) {
+            __atomic_fetch_add(&tree->merges, 1, __ATOMIC_RELAXED);
+            class--;
+            index = parent(index);
+            continue;
+        }
+
+        //The buddy may be given back at the same time and miss this block, so look again once it is free
+        if (initial && QUEUE) {
+            push_lockfree(tree, class, index);
+        }
+        publish(tree, class, index);
+        if (class == 0 || !claim_pair(tree, class, index)) {
+            return;
+        }
+        __atomic_fetch_add(&tree->merges, 1, __ATOMIC_RELAXED);
+        class--;
+        index = parent(index);
+    }
+}
+
+void quiesce(PearTree* tree) {
+    for (int class = 0; class < tree->layers; class++) {
+        tree->stack[class] = -1;
+        tree->tails[class] = -1;
+    }
+}
+
 /**
  * Prints the current state of the tree
  * @param tree peartree
@@ -421,12 +1297,15 @@ void give(PearTree* tree, void* pointer) {
 void display(PearTree* tree, bool verbose) {
     printf("\nTree State:\nAvailability:\n");
     for (int class = 0; class < tree->layers; class++) {
-        printf("Class %d (%d bytes): \t", class, MINIMUM * (1 << (tree->layers - class - 1)));
+        printf("Class %d (%ld bytes): \t", class, block(tree->layers, class));
         if (verbose) {
             for (int layer = 0; layer < class; layer++) {
-                for (int index = 0; index < seg(seg(tree->len, block(tree->layers, layer)), INTSIZE); index++) {
-                    for (int j = 0; j < seg(tree->len, block(tree->layers, layer)) - index * INTSIZE && j < INTSIZE; j++) {
-                        printf("%d", (tree->branches[class][layer][index] & 1 << j) ? 1 : 0);
+                if (!stored(class, layer)) {
+                    continue;
+                }
+                for (long index = 0; index < seg(seg(tree->len, block(tree->layers, layer)), WORDSIZE); index++) {
+                    for (int j = 0; j < seg(tree->len, block(tree->layers, layer)) - index * WORDSIZE && j < WORDSIZE; j++) {
+                        printf("%d", (tree->branches[class][layer][index] & 1ULL << j) ? 1 : 0);
                     }
                 }
                 printf("\n");
@@ -435,9 +1314,9 @@ void display(PearTree* tree, bool verbose) {
                 }
             }
         }
-        for (int index = 0; index < sizer(tree->len, tree->layers, class); index++) {
-            for (int j = 0; j < (tree->len / block(tree->layers, class)) - index * INTSIZE && j < INTSIZE; j++) {
-                printf("%d", (tree->branches[class][class][index] & 1 << j) ? 1 : 0);
+        for (long index = 0; index < sizer(tree->len, tree->layers, class); index++) {
+            for (int j = 0; j < (tree->len / block(tree->layers, class)) - index * WORDSIZE && j < WORDSIZE; j++) {
+                printf("%d", (tree->branches[class][class][index] & 1ULL << j) ? 1 : 0);
             }
             printf(" ");
         }
@@ -447,15 +1326,15 @@ void display(PearTree* tree, bool verbose) {
 
     int count = 0;
 
-    for (int i = 0; i < tree->segments; i++) {
-        if (i % INTSIZE == 0 && i != 0) {
+    for (long i = 0; i < tree->segments; i++) {
+        if (i % WORDSIZE == 0 && i != 0) {
             printf(" ");
         }
-        if (tree->alloc[i] <= 0) {
+        if (mark(tree, i) <= 0) {
             printf("-");
         }
         else {
-            printf("%d", tree->alloc[i] - 1);
+            printf("%d", mark(tree, i) - 1);
         }
     }
 
@@ -463,15 +1342,15 @@ void display(PearTree* tree, bool verbose) {
 
     count = 0;
 
-    for (int i = 0; i < tree->segments; i++) {
-        if (i % INTSIZE == 0 && i != 0) {
+    for (long i = 0; i < tree->segments; i++) {
+        if (i % WORDSIZE == 0 && i != 0) {
             printf(" ");
         }
-        if (tree->alloc[i] >= 0) {
+        if (mark(tree, i) >= 0) {
             printf("-");
         }
         else {
-            printf("%d", ~tree->alloc[i]);
+            printf("%d", ~mark(tree, i));
         }
     }
 
@@ -9,6 +9,8 @@
 #include <stdio.h>
 #include <assert.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
 
 #define debug false
 
@@ -19,6 +21,9 @@
 #define QUEUE true
 #define SPLICE false
 
+//Compact metadata: only the bitmap layers the descent reads are stored, and allocation marks take a nibble
+#define COMPACT true
+
 /**
  * Structure for distributed linked-indexed list implementation of the write stacks
  */
@@ -36,13 +41,26 @@ typedef struct SignPostStruct {
 typedef struct PearTreeStruct {
     void* base;
     void* end;
-    int*** branches;
+    uint64_t*** branches;
     long* stack;
     long* tails;
+
+    //Merges each class put off, and the most it may put off at once
+    long* held;
+    long* hold;
+
+    //Bit c is set while class c has a free block, queued or not
+    uint64_t* available;
     char* alloc;
+    char* coarse;
+    pthread_mutex_t* mutex;
     int layers;
     long len;
     long segments;
+
+    //Blocks split and buddy pairs merged since the tree was attached to its memory
+    long splits;
+    long merges;
 } PearTree;
 
 /**
@@ -53,6 +71,60 @@ typedef struct PearTreeStruct {
  */
 void init(PearTree* tree, void* start, long len);
 
+/**
+ * Initializes a peartree over memory that is already zero, such as a fresh anonymous mapping. Only the
+ * headers and the bits of the initial free blocks are written, so startup costs the same for any heap size
+ * and each metadata page is faulted in when the part of the heap it describes is first used.
+ * @param tree tree pointer
+ * @param start pointer to the beginning of the zeroed memory block
+ * @param len bytes in the memory block
+ */
+void adopt(PearTree* tree, void* start, long len);
+
+/**
+ * Returns a tree to the state init left it in, freeing every block at once. Only the marks and bitmaps are
+ * cleared, so it costs time in proportion to the metadata rather than to the blocks taken. The lock and the
+ * limits set with defer are kept.
+ * @param tree peartree
+ */
+void reset(PearTree* tree);
+
+/**
+ * Reattaches a tree to a memory block it was initialized over, possibly mapped at another address since.
+ * Only the branch tables and the lock are rewritten, the blocks and every other state value are kept, so
+ * reopening costs the same for any heap size.
+ * @param tree tree pointer
+ * @param start pointer to the beginning of the memory block
+ * @param len bytes in the memory block, as it was initialized with
+ */
+void reopen(PearTree* tree, void* start, long len);
+
+/**
+ * Determine the bytes of branch tables a tree over a memory block needs in each process attached to it
+ * @param len bytes in the memory block
+ * @return bytes of tables to pass to attach
+ */
+long tables(long len);
+
+/**
+ * Attaches to a tree another process initialized and may still be using, such as over shared memory mapped
+ * at another address. The branch tables hold absolute pointers, so they are written to process-local memory
+ * and the shared state, lock included, is left untouched.
+ * @param tree tree pointer
+ * @param start pointer to the beginning of the memory block in this process
+ * @param len bytes in the memory block, as it was initialized with
+ * @param tables process-local memory of tables(len) bytes, kept for as long as the tree is used
+ */
+void attach(PearTree* tree, void* start, long len, void* tables);
+
+/**
+ * Determine the bytes of metadata a tree over a memory block places in front of its heap. A tree whose heap
+ * starts on a multiple of its largest block has every block aligned to its own size.
+ * @param len bytes in the memory block
+ * @return offset of the tree's base from the start of the block
+ */
+long prelude(long len);
+
 /**
  * Take a memory block of a given size from the peartrees memory
  * @param tree peartree
@@ -61,6 +133,69 @@ void init(PearTree* tree, void* start, long len);
  */
 void* take(PearTree* tree, long size);
 
+/**
+ * Give a previously allocated chunk back given the size it was taken with, skipping the lookup of its class
+ * @param tree peartree
+ * @param pointer to deallocate
+ * @param size size in bytes passed to take
+ */
+void give_sized(PearTree* tree, void* pointer, long size);
+
+/**
+ * Take up to n memory blocks of one size. A single free block large enough for all of them is split once,
+ * so the bitmaps are updated per block found rather than per block taken.
+ * @param tree peartree
+ * @param size size in bytes
+ * @param out output array of pointers
+ * @param n number of blocks wanted
+ * @return number of blocks taken
+ */
+int take_many(PearTree* tree, long size, void** out, int n);
+
+/**
+ * Give previously allocated chunks back to the tree. Aligned runs of neighbouring blocks, as take_many
+ * hands out, are freed as single larger blocks.
+ * @param tree peartree
+ * @param pointers pointers to deallocate, reordered by address
+ * @param n number of pointers
+ */
+void give_many(PearTree* tree, void** pointers, int n);
+
+/**
+ * Grow an allocated block in place by claiming its free buddies, which only succeeds if the block leads
+ * the larger block serving the new size
+ * @param tree peartree
+ * @param pointer block taken from the tree
+ * @param size new size in bytes
+ * @return whether the block now holds size bytes, the tree is unchanged otherwise
+ */
+bool expand(PearTree* tree, void* pointer, long size);
+
+/**
+ * Shrink an allocated block in place, giving its trailing halves back to the tree
+ * @param tree peartree
+ * @param pointer block taken from the tree
+ * @param size new size in bytes, no larger than the block
+ */
+void shrink(PearTree* tree, void* pointer, long size);
+
+/**
+ * Let a class hold on to freed blocks whose buddies are free too rather than merging them at once, so a block
+ * freed and taken again soon after is not merged and split each time. The merges put off are completed when
+ * a request finds no free block large enough, or by coalesce.
+ * @param tree peartree
+ * @param level size class
+ * @param limit most merges of the class put off at once, zero to merge eagerly
+ */
+void defer(PearTree* tree, int level, long limit);
+
+/**
+ * Merge every pair of free buddies, including those whose merges were put off
+ * @param tree peartree
+ * @return number of pairs merged
+ */
+long coalesce(PearTree* tree);
+
 /**
  * Give a previously allocated chunk of memory back to the tree
  * @param tree peartree
@@ -68,6 +203,97 @@ void* take(PearTree* tree, long size);
  */
 void give(PearTree* tree, void* pointer);
 
+/**
+ * Determine the size of an allocated block
+ * @param tree peartree
+ * @param pointer block taken from the tree
+ * @return size of the block in bytes, or zero if it is not allocated
+ */
+long measure(PearTree* tree, void* pointer);
+
+/**
+ * Check the tree's state for consistency, such as after reopening a heap whose last writer crashed. Walks
+ * every block, so it costs time in proportion to the heap.
+ * @param tree peartree
+ * @return whether every block is either allocated or free exactly once, only block starts are marked, and
+ * every bitmap layer agrees with the one below it
+ */
+bool verify(PearTree* tree);
+
+/**
+ * Return the pages of free blocks of at least a page to the system. The first page of a block sitting on
+ * a class stack is kept so its SignPost survives, everything else may read back as zero afterwards.
+ * @param tree peartree
+ * @param page system page size in bytes
+ * @param advice madvise advice releasing the pages, MADV_DONTNEED is used if it is refused
+ * @return number of bytes released
+ */
+long trim(PearTree* tree, long page, int advice);
+
+/**
+ * Determine the size class that serves a request
+ * @param tree peartree
+ * @param size size in bytes
+ * @return size class, or -1 if the request is larger than the tree
+ */
+int classify(PearTree* tree, long size);
+
+/**
+ * Measure the tree's metadata against the heap it manages
+ * @param tree peartree
+ * @return bytes of metadata per byte of heap
+ */
+double overhead(PearTree* tree);
+
+/**
+ * Make the tree's lock robust, so that a process dying while holding it passes it to the next one instead of
+ * blocking every other process forever. Meant for trees in memory shared between processes, and called
+ * before any other process uses the tree.
+ * @param tree peartree
+ */
+void share(PearTree* tree);
+
+/**
+ * Acquire the tree's lock, blocking until it is available
+ * @param tree peartree
+ * @return false if the previous holder of a shared tree's lock died holding it, which may have left an
+ * operation half done
+ */
+bool lock(PearTree* tree);
+
+/**
+ * Release the tree's lock
+ * @param tree peartree
+ */
+void unlock(PearTree* tree);
+
+/**
+ * Take a memory block without the tree's lock. Blocks are claimed by atomically clearing their bits, the
+ * summaries above them are kept as hints that every writer rechecks, and the class stacks are tagged so a
+ * stale head is never mistaken for the current one. A tree taken from this way must only be given back to
+ * with give_lockfree, and is not put off merging or marked, so measure and give do not know its blocks.
+ * @param tree peartree
+ * @param size size in bytes
+ * @return pointer to the allocated chunk, or null if no free block was large enough, which may also happen
+ * while another thread is halfway through giving back the only one
+ */
+void* take_lockfree(PearTree* tree, long size);
+
+/**
+ * Give a block taken with take_lockfree back without the tree's lock, merging it with its buddies
+ * @param tree peartree
+ * @param pointer block to give back, or null
+ * @param size size in bytes passed to take_lockfree
+ */
+void give_lockfree(PearTree* tree, void* pointer, long size);
+
+/**
+ * End lock-free use of a tree, once no thread is inside take_lockfree or give_lockfree, so that verify and
+ * the locked functions accept it again. Blocks still taken can only be given back with give_sized.
+ * @param tree peartree
+ */
+void quiesce(PearTree* tree);
+
 /**
  * Prints the present state of the tree
  * @param tree peartree
@@ -0,0 +1,90 @@
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+#include "../allocators/write_queue/Buffer.h"
+#include "../allocators/write_queue/Buffer.cpp"
+
+//Heap given to every allocator
+#define HEAP (256L << 20)
+
+//Elements appended to every container
+#define ELEMENTS (1L << 20)
+
+//Times each workload is repeated
+#define ROUNDS 16
+
+/**
+ * Measurements of one workload on one container
+ */
+struct Result
+{
+    double ms;
+    double copied;
+};
+
+/**
+ * Append to a number of containers in turn, so the more there are the more often a neighbour holds the
+ * block a container would have grown into
+ * @param containers containers appended to in turn
+ * @return time and elements copied per element appended
+ */
+template<class Container>
+static Result append(int containers) {
+    WriteQueueAllocator<long> alloc(HEAP);
+    long copied = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        std::vector<Container> all;
+        for (int c = 0; c < containers; c++) {
+            all.emplace_back(alloc);
+        }
+        for (long i = 0; i < ELEMENTS / containers; i++) {
+            for (Container& container : all) {
+                //A vector copies every element it holds whenever its capacity changes
+                std::size_t before = container.capacity();
+                container.push_back(i);
+                copied += container.capacity() != before ? (long) container.size() - 1 : 0;
+            }
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+    return {elapsed.count() / ROUNDS, (double) copied / ROUNDS / ELEMENTS};
+}
+
+/**
+ * Append to a number of buffers in turn, counting the elements they moved rather than grew over
+ */
+static Result buffered(int containers) {
+    WriteQueueAllocator<long> alloc(HEAP);
+    long copied = 0;
+    auto begin = std::chrono::steady_clock::now();
+    for (int round = 0; round < ROUNDS; round++) {
+        std::vector<Buffer<long>> all;
+        for (int c = 0; c < containers; c++) {
+            all.emplace_back(alloc);
+        }
+        for (long i = 0; i < ELEMENTS / containers; i++) {
+            for (Buffer<long>& buffer : all) {
+                buffer.push_back(i);
+            }
+        }
+        for (Buffer<long>& buffer : all) {
+            copied += (long) buffer.relocated;
+        }
+    }
+    std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - begin;
+    return {elapsed.count() / ROUNDS, (double) copied / ROUNDS / ELEMENTS};
+}
+
+int main() {
+    printf("%10s %-8s %10s %16s\n", "containers", "type", "ms", "copies/element");
+    for (int containers : {1, 2, 8, 64}) {
+        Result vector = append<std::vector<long, WriteQueueAllocator<long>>>(containers);
+        Result buffer = buffered(containers);
+        printf("%10d %-8s %10.2f %16.3f\n", containers, "vector", vector.ms, vector.copied);
+        printf("%10d %-8s %10.2f %16.3f\n", containers, "buffer", buffer.ms, buffer.copied);
+    }
+}
@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include <sys/mman.h>
+
+extern "C" {
+    #include "../allocators/write_queue/peartree.h"
+}
+
+//Bytes of heap under each tree
+#define HEAP (64L << 20)
+
+//Calls made by each workload
+#define CALLS 4000000
+
+//Blocks each workload keeps live at once
+#define LIVE 4096
+
+/**
+ * Counts of one run of a workload
+ */
+struct Result
+{
+    double ns;
+    long splits;
+    long merges;
+    long failures;
+    bool whole;
+};
+
+/**
+ * Run a workload over a fresh tree whose classes each put off up to a number of merges
+ * @param limit watermark of every class, zero to merge eagerly
+ * @param sizes request sizes the workload draws from
+ * @param burst blocks taken and given back together, one for random churn
+ * @return counts of the run, whole telling whether the heap merged back into one block at the end
+ */
+static Result run(long limit, const std::vector<long>& sizes, int burst) {
+    void* heap = mmap(nullptr, HEAP, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    PearTree tree;
+    adopt(&tree, heap, HEAP);
+    for (int level = 0; level < tree.layers; level++) {
+        defer(&tree, level, limit);
+    }
+
+    std::mt19937 rng(7);
+    std::vector<std::pair<void*, long>> live(LIVE, {nullptr, 0});
+    std::vector<std::pair<void*, long>> batch((size_t) burst);
+    Result result{};
+    auto begin = std::chrono::steady_clock::now();
+    for (long call = 0; call < CALLS; call += 2L * burst) {
+        if (burst > 1) {
+            //Fill a batch of one size and free it again, as phases of a request loop do
+            long size = sizes[(size_t) (call / (2L * burst)) % sizes.size()];
+            for (auto& slot : batch) {
+                slot = {take(&tree, size), size};
+                result.failures += slot.first == nullptr;
+            }
+            for (auto& slot : batch) {
+                give_sized(&tree, slot.first, slot.second);
+            }
+            continue;
+        }
+
+        //Replace a random live block with one of a random size
+        auto& slot = live[rng() % LIVE];
+        if (slot.first) {
+            give_sized(&tree, slot.first, slot.second);
+        }
+        long size = sizes[rng() % sizes.size()];
+        slot = {take(&tree, size), size};
+        result.failures += slot.first == nullptr;
+    }
+    for (auto& slot : live) {
+        if (slot.first) {
+            give_sized(&tree, slot.first, slot.second);
+        }
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+
+    result.ns = elapsed.count() / CALLS;
+    result.splits = tree.splits;
+    result.merges = tree.merges;
+
+    //Whatever was put off must still merge, until the largest initial block forms again
+    coalesce(&tree);
+    long largest = 1L << (63 - __builtin_clzl((unsigned long) (HEAP - prelude(HEAP))));
+    result.whole = verify(&tree) && take(&tree, largest) != nullptr;
+    munmap(heap, HEAP);
+    return result;
+}
+
+int main() {
+    struct Workload
+    {
+        const char* name;
+        std::vector<long> sizes;
+        int burst;
+    };
+    std::vector<Workload> workloads = {
+            {"bursts", {64, 4096, 256, 64 << 10}, 256},
+            {"churn", {32, 48, 64, 128, 256, 1024, 4096}, 1},
+            {"large", {16 << 10, 64 << 10, 256 << 10, 1 << 20}, 8},
+    };
+
+    printf("%-8s %8s %10s %12s %12s %10s %8s\n", "workload", "limit", "ns/call", "splits", "merges", "failures",
+           "merged");
+    for (const Workload& workload : workloads) {
+        for (long limit : {0L, 16L, 256L, 4096L}) {
+            Result result = run(limit, workload.sizes, workload.burst);
+            printf("%-8s %8ld %10.1f %12ld %12ld %10ld %8s\n", workload.name, limit, result.ns, result.splits,
+                   result.merges, result.failures, result.whole ? "yes" : "no");
+        }
+    }
+}
@@ -0,0 +1,132 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <random>
+#include <vector>
+#include <sys/mman.h>
+
+extern "C" {
+    #include "../allocators/write_queue/peartree.h"
+}
+
+#include "../allocators/write_queue/FixedTree.h"
+
+//Bytes of heap under each engine
+#define HEAP (64L << 20)
+
+//Calls made by each workload
+#define CALLS 8000000
+
+//Blocks the churn workload keeps live at once
+#define LIVE 4096
+
+//Blocks taken and given back together by the burst workload
+#define BURST 512
+
+/**
+ * The runtime engine behind the same interface as FixedTree
+ */
+struct Runtime
+{
+    PearTree tree;
+
+    explicit Runtime(void* start) {
+        //Leave exactly HEAP bytes behind the metadata, so the heap starts out as one block as FixedTree's does
+        long len = HEAP;
+        while (len - prelude(len) < HEAP) {
+            len = HEAP + prelude(len);
+        }
+        adopt(&tree, start, len);
+    }
+
+    void* take(size_t size) {
+        return ::take(&tree, (long) size);
+    }
+
+    void give(void* pointer, size_t size) {
+        give_sized(&tree, pointer, (long) size);
+    }
+};
+
+using Fixed = FixedTree<HEAP>;
+
+/**
+ * Run a workload against an engine
+ * @param engine engine to allocate from
+ * @param workload 0 for same-size pairs, 1 for random churn, 2 for bursts
+ * @return nanoseconds per call
+ */
+template<class Engine>
+static double run(Engine& engine, int workload) {
+    const size_t sizes[] = {16, 24, 48, 64, 200, 512, 1024, 4096, 16 << 10, 64 << 10};
+    const size_t kinds = sizeof(sizes) / sizeof(*sizes);
+    std::mt19937 rng(11);
+    std::vector<std::pair<void*, size_t>> live(LIVE, {nullptr, 0});
+    std::vector<void*> batch(BURST);
+
+    auto begin = std::chrono::steady_clock::now();
+    for (long call = 0; call < CALLS;) {
+        if (workload == 0) {
+            size_t size = sizes[call / 2 % kinds];
+            engine.give(engine.take(size), size);
+            call += 2;
+        }
+        else if (workload == 1) {
+            auto& slot = live[rng() % LIVE];
+            if (slot.first) {
+                engine.give(slot.first, slot.second);
+            }
+            slot.second = sizes[rng() % kinds];
+            slot.first = engine.take(slot.second);
+            call += 2;
+        }
+        else {
+            size_t size = sizes[call / (2 * BURST) % kinds];
+            for (void*& block : batch) {
+                block = engine.take(size);
+            }
+            for (void* block : batch) {
+                engine.give(block, size);
+            }
+            call += 2 * BURST;
+        }
+    }
+    for (auto& slot : live) {
+        if (slot.first) {
+            engine.give(slot.first, slot.second);
+        }
+    }
+    return std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / CALLS;
+}
+
+/**
+ * Map zeroed memory, so neither engine pays for clearing its metadata
+ */
+static void* fresh(size_t len) {
+    void* p = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (p == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    return p;
+}
+
+int main() {
+    const char* names[] = {"pairs", "churn", "bursts"};
+    printf("%-8s %12s %12s %8s\n", "workload", "runtime ns", "fixed ns", "speedup");
+    for (int workload = 0; workload < 3; workload++) {
+        void* start = fresh(2 * HEAP);
+        Runtime runtime(start);
+        double slow = run(runtime, workload);
+        munmap(start, 2 * HEAP);
+
+        void* heap = fresh(HEAP);
+        auto* fixed = new (fresh(sizeof(Fixed))) Fixed(heap, true);
+        double fast = run(*fixed, workload);
+        munmap(fixed, sizeof(Fixed));
+        munmap(heap, HEAP);
+
+        printf("%-8s %12.1f %12.1f %7.2fx\n", names[workload], slow, fast, slow / fast);
+    }
+}
@@ -0,0 +1,167 @@
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/mman.h>
+
+extern "C" {
+    #include "../allocators/write_queue/peartree.h"
+}
+
+//Bytes of heap under the tree
+#define HEAP (64L << 20)
+
+//Blocks handed between threads through the shared slots during the stress run
+#define SLOTS 4096
+
+//Calls each thread makes
+#define CALLS 1000000
+
+//Blocks each thread keeps live in the scaling runs
+#define LIVE 64
+
+/**
+ * Map a zeroed heap and adopt a tree over it
+ */
+static PearTree* fresh() {
+    void* start = mmap(nullptr, HEAP, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE, -1, 0);
+    if (start == MAP_FAILED) {
+        perror("mmap");
+        exit(1);
+    }
+    auto* tree = new PearTree;
+    adopt(tree, start, HEAP);
+    return tree;
+}
+
+static void discard(PearTree* tree) {
+    munmap(tree->alloc, HEAP);
+    delete tree;
+}
+
+/**
+ * Fill a block with a pattern derived from its address and size, so overlapping blocks clobber each other's
+ */
+static void fill(unsigned char* block, long size) {
+    memcpy(block, &size, sizeof(size));
+    memset(block + sizeof(size), (int) ((uintptr_t) block >> 4 & 255), (size_t) size - sizeof(size));
+}
+
+static bool intact(const unsigned char* block) {
+    long size;
+    memcpy(&size, block, sizeof(size));
+    for (long i = sizeof(size); i < size; i++) {
+        if (block[i] != (unsigned char) ((uintptr_t) block >> 4 & 255)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Hammer a tree from several threads, handing blocks between them so most are given back by a thread other
+ * than the one that took them, and check that no two blocks ever overlap and that everything merges back
+ * @param threads number of threads
+ * @return whether the tree came through intact
+ */
+static bool stress(int threads) {
+    PearTree* tree = fresh();
+    std::vector<std::atomic<unsigned char*>> slots(SLOTS);
+    std::atomic<bool> broken{false};
+    std::vector<std::thread> workers;
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng((unsigned) t);
+            for (long call = 0; call < CALLS && !broken.load(std::memory_order_relaxed); call++) {
+                long size = 16 + (long) (rng() % (rng() % 8 ? 256 : 8192));
+                auto* block = (unsigned char*) take_lockfree(tree, size);
+                if (block) {
+                    fill(block, size);
+                }
+                unsigned char* old = slots[rng() % SLOTS].exchange(block);
+                if (old) {
+                    long was;
+                    memcpy(&was, old, sizeof(was));
+                    if (!intact(old)) {
+                        broken = true;
+                    }
+                    give_lockfree(tree, old, was);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    for (auto& slot : slots) {
+        if (unsigned char* old = slot.exchange(nullptr)) {
+            long was;
+            memcpy(&was, old, sizeof(was));
+            broken = broken || !intact(old);
+            give_lockfree(tree, old, was);
+        }
+    }
+
+    //Everything given back must have merged into the blocks the tree started with
+    quiesce(tree);
+    PearTree* pristine = fresh();
+    bool whole = verify(tree) && *tree->available == *pristine->available;
+    discard(pristine);
+    discard(tree);
+    return whole && !broken;
+}
+
+/**
+ * Measure take and give pairs from several threads, each keeping a few blocks live
+ * @param threads number of threads
+ * @param lockfree whether to use the lock-free calls rather than the locked ones
+ * @return millions of calls per second over all threads
+ */
+static double scale(int threads, bool lockfree) {
+    PearTree* tree = fresh();
+    std::vector<std::thread> workers;
+    auto begin = std::chrono::steady_clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&, t] {
+            std::mt19937 rng((unsigned) t);
+            std::pair<void*, long> live[LIVE] = {};
+            for (long call = 0; call < CALLS; call += 2) {
+                auto& slot = live[rng() % LIVE];
+                if (lockfree) {
+                    give_lockfree(tree, slot.first, slot.second);
+                    slot.second = 16L << rng() % 8;
+                    slot.first = take_lockfree(tree, slot.second);
+                }
+                else {
+                    lock(tree);
+                    give_sized(tree, slot.first, slot.second);
+                    slot.second = 16L << rng() % 8;
+                    slot.first = take(tree, slot.second);
+                    unlock(tree);
+                }
+            }
+        });
+    }
+    for (std::thread& worker : workers) {
+        worker.join();
+    }
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    discard(tree);
+    return (double) threads * CALLS / seconds / 1e6;
+}
+
+int main() {
+    printf("%-8s %12s\n", "threads", "stress");
+    for (int threads : {1, 2, 4, 8}) {
+        printf("%-8d %12s\n", threads, stress(threads) ? "intact" : "BROKEN");
+    }
+
+    printf("\n%-8s %12s %12s\n", "threads", "locked Mops", "lock-free");
+    for (int threads : {1, 2, 4, 8, 16}) {
+        printf("%-8d %12.2f %12.2f\n", threads, scale(threads, false), scale(threads, true));
+    }
+}
@@ -0,0 +1,85 @@
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../allocators/write_queue/Persistent.h"
+
+//Bytes of heap in the file
+#define HEAP (1L << 30)
+
+//Nodes kept in the heap across reopens
+#define NODES 1000000
+
+/**
+ * Node of a list kept in the heap, linked by offset so it survives being mapped elsewhere
+ */
+struct Node
+{
+    uint64_t next;
+    long value;
+};
+
+static double since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/**
+ * Walk the list from the root, checking every node
+ * @return whether the list holds every node in order
+ */
+static bool walk(Persistent& heap) {
+    long count = 0;
+    for (Node* node = (Node*) heap.root(); node; node = (Node*) heap.at(node->next), count++) {
+        if (node->value != NODES - 1 - count) {
+            return false;
+        }
+    }
+    return count == NODES;
+}
+
+int main(int argc, char** argv) {
+    const char* path = argc > 1 ? argv[1] : "/tmp/peartree.heap";
+    unlink(path);
+
+    auto begin = std::chrono::steady_clock::now();
+    {
+        Persistent heap(path, HEAP);
+        Node* head = nullptr;
+        for (long i = 0; i < NODES; i++) {
+            Node* node = (Node*) heap.allocate(sizeof(Node));
+            *node = {heap.offset(head), i};
+            head = node;
+        }
+        heap.root(head);
+    }
+    printf("%-24s %10.2f ms\n", "create and fill", since(begin));
+
+    begin = std::chrono::steady_clock::now();
+    {
+        Persistent heap(path, 0);
+        double open = since(begin);
+        bool ok = walk(heap);
+        printf("%-24s %10.3f ms, walked %s in %.2f ms\n", "reopen clean", open, ok ? "intact" : "broken",
+               since(begin) - open);
+    }
+
+    //Change the heap in a child that dies without syncing, as a crash would
+    pid_t pid = fork();
+    if (pid == 0) {
+        Persistent heap(path, 0);
+        heap.deallocate(heap.allocate(64));
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+
+    begin = std::chrono::steady_clock::now();
+    {
+        Persistent heap(path, 0);
+        double open = since(begin);
+        printf("%-24s %10.3f ms, %s, list %s\n", "reopen after crash", open,
+               heap.recovered ? "verified" : "not verified", walk(heap) ? "intact" : "broken");
+    }
+    unlink(path);
+}
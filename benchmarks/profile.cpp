@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+/**
+ * Measures what the Sampling policy costs over the Silent one, then profiles two call sites keeping known amounts
+ * live and prints their folded stacks, with the estimated live bytes next to the real ones.
+ *
+ *  profile_benchmark [pprof output]
+ */
+
+//Bytes of heap under each allocator
+#define HEAP (256L << 20)
+
+//Calls made by the overhead workload
+#define CALLS 8000000
+
+//Runs of the overhead workload per policy
+#define RUNS 5
+
+//Blocks the overhead workload keeps live at once
+#define LIVE 4096
+
+//Sampling rate of the attribution run, low so its estimates come from many samples
+#define RATE (64L << 10)
+
+/**
+ * Replace random live allocations with ones of random sizes
+ * @param allocator allocator to churn
+ * @return nanoseconds per call
+ */
+template<class Policy>
+static double churn(WriteQueueAllocator<char, Policy>& allocator) {
+    const size_t sizes[] = {16, 24, 48, 64, 200, 512, 1024, 4096};
+    std::mt19937 rng(5);
+    std::vector<std::pair<char*, size_t>> live(LIVE, {nullptr, 0});
+    auto begin = std::chrono::steady_clock::now();
+    for (long call = 0; call < CALLS; call += 2) {
+        auto& slot = live[rng() % LIVE];
+        if (slot.first) {
+            allocator.deallocate(slot.first, slot.second);
+        }
+        slot.second = sizes[rng() % (sizeof(sizes) / sizeof(*sizes))];
+        slot.first = allocator.allocate(slot.second);
+    }
+    double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count() / CALLS;
+    for (auto& slot : live) {
+        if (slot.first) {
+            allocator.deallocate(slot.first, slot.second);
+        }
+    }
+    return ns;
+}
+
+/**
+ * Call sites of the attribution run, kept out of line so each shows up as a frame of its own
+ */
+[[gnu::noinline]] void requests(WriteQueueAllocator<char, Sampling>& allocator, std::vector<char*>& out) {
+    for (int i = 0; i < 96 * 1024; i++) {
+        out.push_back(allocator.allocate(256));
+    }
+}
+
+[[gnu::noinline]] void cache(WriteQueueAllocator<char, Sampling>& allocator, std::vector<char*>& out) {
+    for (int i = 0; i < 2 * 1024; i++) {
+        out.push_back(allocator.allocate(4096));
+    }
+}
+
+int main(int argc, char** argv) {
+    WriteQueueAllocator<char> silent(HEAP);
+    WriteQueueAllocator<char, Sampling> sampling(HEAP, Config{}, Sampling(SAMPLE_RATE));
+    //Alternate the two and keep the best run of each, as single runs vary by more than the difference
+    double base = 1e9, sampled = 1e9;
+    for (int run = 0; run < RUNS; run++) {
+        base = std::min(base, churn(silent));
+        sampled = std::min(sampled, churn(sampling));
+    }
+    printf("%-10s %10s\n%-10s %10.1f\n%-10s %10.1f\n%-10s %9.1f%%\n\n", "policy", "ns/call", "silent", base, "sampling",
+           sampled, "overhead", (sampled / base - 1) * 100);
+
+    //Sample on a thread of its own, whose countdown was not drawn at the overhead run's rate
+    WriteQueueAllocator<char, Sampling> profiled(HEAP, Config{}, Sampling(RATE));
+    std::vector<char*> small, large;
+    std::thread([&] {
+        requests(profiled, small);
+        cache(profiled, large);
+    }).join();
+    long real = (long) (small.size() * 256 + large.size() * 4096);
+    const Profile& profile = *profiled.policy().profile;
+    printf("live %ld bytes, estimated %ld from samples every %ld bytes\n\n", real, profile.estimate(), RATE);
+    profile.dump(stdout, Folded);
+    if (argc > 1) {
+        profile.dump(argv[1], Pprof);
+    }
+
+    for (char* p : small) {
+        profiled.deallocate(p, 256);
+    }
+    for (char* p : large) {
+        profiled.deallocate(p, 4096);
+    }
+    printf("\nafter freeing everything, estimated %ld\n", profile.estimate());
+}
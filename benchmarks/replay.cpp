@@ -0,0 +1,209 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unordered_map>
+#include <vector>
+#include <malloc.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../allocators/malloc/MallocAllocator.h"
+#include "../allocators/malloc/MallocAllocator.cpp"
+
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+/**
+ * Replays a trace recorded with the Tracing policy against an allocator, reporting throughput, latency
+ * percentiles, peak footprint and fragmentation over time. Calls of every thread are replayed by a single
+ * thread in time order, each allocator in a process of its own so their footprints are measured apart.
+ *
+ *  trace_replay <trace> [malloc|write_queue|all] [heap MiB per shard]
+ */
+
+//Points in time the footprint is sampled at
+#define SAMPLES 20
+
+/**
+ * A call resolved against the trace, with allocations numbered so replay needs no lookups of its own
+ */
+struct Step
+{
+    bool allocate;
+    uint32_t slot;
+    uint64_t size;
+};
+
+/**
+ * Read the resident set of the process
+ * @return resident bytes
+ */
+static long resident() {
+    long pages = 0;
+    long size = 0;
+    if (FILE* statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * sysconf(_SC_PAGESIZE);
+}
+
+/**
+ * Number the allocations of a trace, reusing the numbers of freed ones
+ * @param records trace in time order
+ * @param slots set to the most allocations live at once
+ * @return calls to replay, deallocations of allocations made before the trace started left out
+ */
+static std::vector<Step> resolve(const std::vector<Record>& records, uint32_t& slots) {
+    std::vector<Step> steps;
+    std::unordered_map<uint64_t, uint32_t> live;
+    std::vector<uint32_t> spare;
+    slots = 0;
+    for (const Record& record : records) {
+        if (record.op == Allocated) {
+            uint32_t slot = spare.empty() ? slots++ : spare.back();
+            if (!spare.empty()) {
+                spare.pop_back();
+            }
+            live[record.address] = slot;
+            steps.push_back({true, slot, record.size});
+        }
+        else if (record.op == Deallocated) {
+            auto found = live.find(record.address);
+            if (found != live.end()) {
+                steps.push_back({false, found->second, record.size});
+                spare.push_back(found->second);
+                live.erase(found);
+            }
+        }
+    }
+    return steps;
+}
+
+/**
+ * Replay the calls against an allocator and print its report
+ * @param name allocator name
+ * @param alloc allocator of chars
+ * @param steps calls to replay
+ * @param slots most allocations live at once
+ */
+template<class Allocator>
+static void replay(const char* name, Allocator& alloc, const std::vector<Step>& steps, uint32_t slots) {
+    //Fault in everything replay writes to before measuring, so only the allocator's own memory is counted
+    std::vector<std::pair<char*, uint64_t>> live(slots, {nullptr, 0});
+    std::vector<uint32_t> latencies(steps.size(), 1);
+
+    //Hand back what reading the trace left in malloc's heap, or malloc would reuse pages that are counted already
+    malloc_trim(0);
+    long page = sysconf(_SC_PAGESIZE);
+    long floor = resident();
+    long peak = 0;
+    long requested = 0;
+    long failures = 0;
+
+    printf("%s\n%10s %12s %12s %8s\n", name, "call", "live MiB", "resident MiB", "frag");
+    size_t every = std::max<size_t>(1, steps.size() / SAMPLES);
+    std::chrono::nanoseconds total{0};
+    for (size_t i = 0; i < steps.size(); i++) {
+        const Step& step = steps[i];
+        auto& slot = live[step.slot];
+        auto begin = std::chrono::steady_clock::now();
+        if (step.allocate) {
+            try {
+                slot = {alloc.allocate(step.size), step.size};
+            }
+            catch (const std::bad_alloc&) {
+                slot = {nullptr, 0};
+                failures++;
+            }
+        }
+        else if (slot.first) {
+            alloc.deallocate(slot.first, slot.second);
+        }
+        auto elapsed = std::chrono::steady_clock::now() - begin;
+        total += elapsed;
+        latencies[i] = (uint32_t) std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+
+        //Programs write to what they allocate, touch every page so the footprint reflects it
+        if (step.allocate && slot.first) {
+            for (uint64_t offset = 0; offset < slot.second; offset += page) {
+                slot.first[offset] = 1;
+            }
+            requested += (long) slot.second;
+        }
+        else if (!step.allocate && slot.first) {
+            requested -= (long) slot.second;
+            slot = {nullptr, 0};
+        }
+
+        if (i % every == every - 1 || i + 1 == steps.size()) {
+            long used = resident() - floor;
+            peak = std::max(peak, used);
+            double fragmentation = used > 0 ? std::max(0.0, 1 - (double) requested / (double) used) : 0;
+            printf("%10zu %12.1f %12.1f %7.1f%%\n", i + 1, (double) requested / (1 << 20),
+                   (double) used / (1 << 20), 100 * fragmentation);
+        }
+    }
+
+    std::sort(latencies.begin(), latencies.end());
+    auto at = [&](double q) {
+        return latencies.empty() ? 0 : latencies[(size_t) (q * (double) (latencies.size() - 1))];
+    };
+    double seconds = std::chrono::duration<double>(total).count();
+    printf("%10s %10.2f Mops/s, p50 %u ns, p99 %u ns, p999 %u ns, peak %.1f MiB, %ld failed\n\n", "total",
+           seconds > 0 ? (double) steps.size() / seconds / 1e6 : 0, at(0.5), at(0.99), at(0.999),
+           (double) peak / (1 << 20), failures);
+}
+
+/**
+ * Replay against one allocator in a child process
+ */
+template<class Run>
+static void isolate(Run run) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        run();
+        fflush(stdout);
+        _exit(0);
+    }
+    waitpid(pid, nullptr, 0);
+}
+
+int main(int argc, char** argv) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <trace> [malloc|write_queue|all] [heap MiB per shard]\n", argv[0]);
+        return 2;
+    }
+    const char* which = argc > 2 ? argv[2] : "all";
+    size_t heap = (size_t) (argc > 3 ? atol(argv[3]) : 1024) << 20;
+
+    std::vector<Record> records;
+    if (!Trace::read(argv[1], records)) {
+        fprintf(stderr, "%s is not a trace\n", argv[1]);
+        return 1;
+    }
+    uint32_t slots = 0;
+    std::vector<Step> steps = resolve(records, slots);
+    records = std::vector<Record>();
+    printf("%zu calls, at most %u allocations live\n\n", steps.size(), slots);
+
+    if (!strcmp(which, "malloc") || !strcmp(which, "all")) {
+        isolate([&] {
+            MallocAllocator<char, Silent> alloc;
+            replay("malloc", alloc, steps, slots);
+        });
+    }
+    if (!strcmp(which, "write_queue") || !strcmp(which, "all")) {
+        isolate([&] {
+            Config config;
+            config.growable = true;
+            WriteQueueAllocator<char> alloc(heap, config);
+            replay("write_queue", alloc, steps, slots);
+        });
+    }
+}
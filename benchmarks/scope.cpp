@@ -0,0 +1,116 @@
+#include <chrono>
+#include <cstdio>
+#include <list>
+#include <random>
+#include <vector>
+
+#include "../allocators/write_queue/Scope.h"
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+//Bytes of heap under the arena
+#define HEAP (64L << 20)
+
+//Bytes of heap each request's scope serves
+#define SCOPED (256L << 10)
+
+//Requests served by each run
+#define REQUESTS 100000
+
+//Objects and list nodes each request allocates
+#define OBJECTS 300
+#define NODES 200
+
+/**
+ * Requests served through the arena's allocator, whose allocations are freed one by one
+ */
+struct Individual
+{
+    WriteQueueAllocator<char> allocator{HEAP};
+
+    void* allocate(size_t size) { return allocator.allocate(size); }
+
+    template<class T>
+    WriteQueueAllocator<T> bind() { return WriteQueueAllocator<T>(allocator); }
+
+    void finish(std::vector<std::pair<void*, size_t>>& objects) {
+        for (auto& object : objects) {
+            allocator.deallocate((char*) object.first, object.second);
+        }
+    }
+};
+
+/**
+ * Requests served from a scope reset at the end of each, nothing freed one by one
+ */
+struct Scoped
+{
+    Scope scope;
+
+    explicit Scoped(Arena& arena) : scope(arena, SCOPED) {}
+
+    void* allocate(size_t size) { return scope.allocate((long) size); }
+
+    template<class T>
+    ScopeAllocator<T> bind() { return ScopeAllocator<T>(scope); }
+
+    void finish(std::vector<std::pair<void*, size_t>>&) { scope.reset(); }
+};
+
+/**
+ * Serve requests that allocate objects of mixed sizes and build a list and a vector, then tear everything down
+ * @param source allocations of the requests
+ * @param teardown set to nanoseconds per request spent tearing down
+ * @return nanoseconds per request
+ */
+template<class Source>
+static double serve(Source& source, double& teardown) {
+    const size_t sizes[] = {24, 48, 64, 128, 256, 512};
+    std::mt19937 rng(3);
+    std::vector<std::pair<void*, size_t>> objects(OBJECTS);
+    std::chrono::duration<double, std::nano> tearing{};
+    auto begin = std::chrono::steady_clock::now();
+    for (int request = 0; request < REQUESTS; request++) {
+        for (auto& object : objects) {
+            object.second = sizes[rng() % (sizeof(sizes) / sizeof(*sizes))];
+            object.first = source.allocate(object.second);
+        }
+        std::list<long, decltype(source.template bind<long>())> nodes(NODES, 0L, source.template bind<long>());
+        std::vector<long, decltype(source.template bind<long>())> values(source.template bind<long>());
+        for (long value : nodes) {
+            values.push_back(value);
+        }
+
+        auto before = std::chrono::steady_clock::now();
+        nodes.clear();
+        values.clear();
+        values.shrink_to_fit();
+        source.finish(objects);
+        tearing += std::chrono::steady_clock::now() - before;
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - begin;
+    teardown = tearing.count() / REQUESTS;
+    return elapsed.count() / REQUESTS;
+}
+
+int main() {
+    Individual individual;
+    Scoped scoped(*individual.allocator.arena);
+    double freeing = 0, resetting = 0;
+    serve(individual, freeing);
+    serve(scoped, resetting);
+    double freed = serve(individual, freeing);
+    double reset = serve(scoped, resetting);
+    printf("%-12s %12s %12s\n", "freed by", "ns/request", "ns teardown");
+    printf("%-12s %12.0f %12.0f\n", "individual", freed, freeing);
+    printf("%-12s %12.0f %12.0f\n", "scope reset", reset, resetting);
+
+    //A nested scope gives its block back to its parent whole, whatever was allocated in it
+    Scope outer(*individual.allocator.arena, SCOPED);
+    {
+        Scope inner(outer, SCOPED / 4);
+        inner.allocate(1024);
+    }
+    bool whole = verify(&outer.tree) && outer.allocate((long) outer.capacity() / 2) != nullptr;
+    printf("\nnested scope gave its block back: %s\n", whole ? "yes" : "no");
+}
@@ -0,0 +1,60 @@
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <thread>
+#include <vector>
+
+#include "../allocators/write_queue/Arena.h"
+
+//Blocks each thread keeps live while it churns
+#define LIVE 256
+
+//Replacements performed by each thread
+#define OPERATIONS 200000
+
+//Total heap shared by all shards
+#define HEAP (256L << 20)
+
+/**
+ * Churn through random sizes, one in eight of them too large for the thread caches so the trees are hit
+ * @param arena arena to allocate from
+ * @param seed random seed
+ */
+static void churn(Arena* arena, unsigned seed) {
+    std::mt19937 rng(seed);
+    std::vector<std::pair<void*, long>> live(LIVE, {nullptr, 0});
+    for (long op = 0; op < OPERATIONS; op++) {
+        auto& slot = live[rng() % LIVE];
+        arena->deallocate(slot.first, slot.second);
+        long size = rng() % 8 ? 16 + rng() % 496 : (48 << 10) + rng() % (48 << 10);
+        slot = {arena->allocate(size), size};
+    }
+    for (auto& slot : live) {
+        arena->deallocate(slot.first, slot.second);
+    }
+}
+
+/**
+ * Measure allocation throughput for a thread and shard count
+ * @return millions of operations per second
+ */
+static double measure(int threads, int shards) {
+    Arena arena(HEAP / shards, shards);
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<std::thread> workers;
+    for (int i = 0; i < threads; i++) {
+        workers.emplace_back(churn, &arena, i + 1);
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    return 2.0 * OPERATIONS * threads / elapsed.count() / 1e6;
+}
+
+int main() {
+    printf("%8s %16s %16s\n", "threads", "1 shard Mops/s", "N shards Mops/s");
+    for (int threads = 1; threads <= 16; threads *= 2) {
+        printf("%8d %16.2f %16.2f\n", threads, measure(threads, 1), measure(threads, threads));
+    }
+}
@@ -0,0 +1,173 @@
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../allocators/write_queue/Shared.h"
+
+//Segment shared by the worker processes
+#define SEGMENT "/peartree-benchmark"
+
+//Bytes of heap in the segment
+#define HEAP (16L << 20)
+
+//Bytes of each buffer handed over
+#define MESSAGE (256L << 10)
+
+//Buffers each producer hands over
+#define MESSAGES 4000
+
+//Producer processes feeding the consumer
+#define PRODUCERS 2
+
+/**
+ * Fill a buffer with a pattern the consumer can check
+ */
+static void fill(char* buffer, long seed) {
+    for (long i = 0; i < MESSAGE; i += 64) {
+        buffer[i] = (char) (seed + i / 64);
+    }
+}
+
+static bool check(const char* buffer, long seed) {
+    for (long i = 0; i < MESSAGE; i += 64) {
+        if (buffer[i] != (char) (seed + i / 64)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Write all of a buffer to a pipe
+ */
+static void send(int fd, const void* data, size_t len) {
+    for (size_t sent = 0; sent < len;) {
+        ssize_t n = write(fd, (const char*) data + sent, len - sent);
+        if (n <= 0) {
+            _exit(1);
+        }
+        sent += (size_t) n;
+    }
+}
+
+/**
+ * Read all of a buffer from a pipe
+ * @return whether it was read before the pipe closed
+ */
+static bool receive(int fd, void* data, size_t len) {
+    for (size_t got = 0; got < len;) {
+        ssize_t n = read(fd, (char*) data + got, len - got);
+        if (n <= 0) {
+            return false;
+        }
+        got += (size_t) n;
+    }
+    return true;
+}
+
+/**
+ * Hand buffers from the producers to a consumer, either as handles into the segment or by copying them
+ * through a pipe
+ * @param handles whether to pass handles rather than contents
+ * @return gigabytes handed over per second, or a negative value if the consumer saw a corrupt buffer
+ */
+static double run(bool handles) {
+    Shared::remove(SEGMENT);
+    Shared heap(SEGMENT, HEAP);
+
+    //One pipe per producer so large copies never interleave
+    int fds[PRODUCERS][2];
+    for (auto& fd : fds) {
+        if (pipe(fd) != 0) {
+            return -1;
+        }
+    }
+
+    auto begin = std::chrono::steady_clock::now();
+    std::vector<pid_t> producers;
+    for (int p = 0; p < PRODUCERS; p++) {
+        pid_t pid = fork();
+        if (pid == 0) {
+            Shared attached(SEGMENT, 0);
+            std::vector<char> copy(MESSAGE);
+            for (long m = 0; m < MESSAGES; m++) {
+                long seed = p * MESSAGES + m;
+                if (handles) {
+                    //Wait for the consumer to free buffers rather than failing when the heap is full
+                    char* buffer;
+                    while ((buffer = (char*) attached.allocate(MESSAGE)) == nullptr) {
+                        usleep(10);
+                    }
+                    fill(buffer, seed);
+                    uint64_t message[2] = {attached.offset(buffer), (uint64_t) seed};
+                    send(fds[p][1], message, sizeof(message));
+                }
+                else {
+                    fill(copy.data(), seed);
+                    send(fds[p][1], &seed, sizeof(seed));
+                    send(fds[p][1], copy.data(), MESSAGE);
+                }
+            }
+            _exit(0);
+        }
+        producers.push_back(pid);
+        close(fds[p][1]);
+    }
+
+    //Read whichever producer is ready, one may be waiting on buffers the consumer has yet to free
+    std::vector<char> copy(MESSAGE);
+    auto consume = [&](int fd) {
+        if (handles) {
+            uint64_t message[2];
+            if (!receive(fd, message, sizeof(message))) {
+                return false;
+            }
+            char* buffer = (char*) heap.at(message[0]);
+            bool ok = check(buffer, (long) message[1]);
+            heap.deallocate(buffer, MESSAGE);
+            return ok;
+        }
+        long seed;
+        return receive(fd, &seed, sizeof(seed)) && receive(fd, copy.data(), MESSAGE) && check(copy.data(), seed);
+    };
+
+    bool intact = true;
+    pollfd ready[PRODUCERS];
+    for (int p = 0; p < PRODUCERS; p++) {
+        ready[p] = {fds[p][0], POLLIN, 0};
+    }
+    for (long m = 0, open = PRODUCERS; intact && m < MESSAGES * PRODUCERS;) {
+        if (open == 0 || poll(ready, PRODUCERS, -1) <= 0) {
+            intact = false;
+            break;
+        }
+        for (pollfd& producer : ready) {
+            if (producer.revents & POLLIN) {
+                intact &= consume(producer.fd);
+                m++;
+            }
+            else if (producer.revents) {
+                //Closed with nothing left to read, poll skips negative descriptors
+                producer.fd = -1;
+                open--;
+            }
+        }
+    }
+    for (int p = 0; p < PRODUCERS; p++) {
+        close(fds[p][0]);
+        waitpid(producers[p], nullptr, 0);
+    }
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+    Shared::remove(SEGMENT);
+    return intact ? (double) MESSAGE * MESSAGES * PRODUCERS / elapsed.count() / 1e9 : -1;
+}
+
+int main() {
+    printf("%-10s %10s\n", "hand-off", "GB/s");
+    printf("%-10s %10.2f\n", "copies", run(false));
+    printf("%-10s %10.2f\n", "handles", run(true));
+}
@@ -0,0 +1,89 @@
+#include <chrono>
+#include <cstdio>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+//Largest heap initialized eagerly, clearing the metadata of larger ones would commit gigabytes
+#define EAGER (16L << 30)
+
+/**
+ * Read the resident set of the process
+ * @return resident KiB
+ */
+static long resident() {
+    long pages = 0;
+    long size = 0;
+    if (FILE* statm = fopen("/proc/self/statm", "r")) {
+        if (fscanf(statm, "%ld %ld", &size, &pages) != 2) {
+            pages = 0;
+        }
+        fclose(statm);
+    }
+    return pages * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+static double since(std::chrono::steady_clock::time_point begin) {
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+}
+
+/**
+ * Construct an allocator over a virtual heap and take its first blocks
+ * @param heap heap size in bytes
+ */
+static void lazy(long heap) {
+    long before = resident();
+    auto begin = std::chrono::steady_clock::now();
+    WriteQueueAllocator<char> alloc((size_t) heap);
+    double construct = since(begin);
+    long built = resident();
+
+    begin = std::chrono::steady_clock::now();
+    char* small = alloc.allocate(64);
+    char* page = alloc.allocate(4096);
+    double first = since(begin);
+
+    printf("%-6s %4ld GiB %12.1f %12.1f %12ld %12ld %8.2f%%\n", "lazy", heap >> 30, construct, first,
+           built - before, resident() - before, 100 * alloc.arena->overhead());
+    alloc.deallocate(small, 64);
+    alloc.deallocate(page, 4096);
+}
+
+/**
+ * Initialize a tree the way the constructor used to, clearing all of its metadata
+ * @param heap heap size in bytes
+ */
+static void eager(long heap) {
+    void* start = mmap(nullptr, (size_t) heap, PROT_READ | PROT_WRITE, MAP_ANON | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (start == MAP_FAILED) {
+        return;
+    }
+    long before = resident();
+    auto begin = std::chrono::steady_clock::now();
+    PearTree tree;
+    init(&tree, start, heap);
+    double construct = since(begin);
+    long built = resident();
+
+    begin = std::chrono::steady_clock::now();
+    take(&tree, 64);
+    take(&tree, 4096);
+    double first = since(begin);
+
+    printf("%-6s %4ld GiB %12.1f %12.1f %12ld %12ld %8.2f%%\n", "eager", heap >> 30, construct, first,
+           built - before, resident() - before, 100 * overhead(&tree));
+    munmap(start, (size_t) heap);
+}
+
+int main() {
+    printf("%-6s %8s %12s %12s %12s %12s %9s\n", "init", "heap", "build us", "first us", "built KiB",
+           "first KiB", "metadata");
+    for (long heap : {1L << 30, 16L << 30, 64L << 30}) {
+        lazy(heap);
+        if (heap <= EAGER) {
+            eager(heap);
+        }
+    }
+}
@@ -0,0 +1,411 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../allocators/malloc/MallocAllocator.h"
+#include "../allocators/malloc/MallocAllocator.cpp"
+
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+//Heap given to every WriteQueueAllocator
+#define HEAP (256L << 20)
+
+//Calls sampled before latencies stop being recorded
+#define SAMPLES (1L << 23)
+
+/**
+ * Measurements shared by every probe in the process
+ */
+struct Recorder
+{
+    uint32_t* latencies = nullptr;
+    std::atomic<long> calls{0};
+    std::atomic<long> live{0};
+    std::atomic<long> peak{0};
+
+    /**
+     * Fault in the sample buffer up front so it weighs the same on every child's resident set
+     */
+    void prepare() {
+        latencies = new uint32_t[SAMPLES];
+        std::fill(latencies, latencies + SAMPLES, 0);
+    }
+
+    /**
+     * Account a call's bytes and reserve its latency sample, ahead of the call so that nothing after a
+     * deallocation touches more of the recorder than its sample
+     * @return sample of the call
+     */
+    long enter(long bytes) {
+        long now = live += bytes;
+        for (long high = peak; now > high && !peak.compare_exchange_weak(high, now););
+        return calls++;
+    }
+
+    void leave(long call, std::chrono::steady_clock::time_point begin) {
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin);
+        if (call < SAMPLES) {
+            latencies[call] = (uint32_t) ns.count();
+        }
+    }
+};
+
+static Recorder recorder;
+
+/**
+ * Allocator adaptor timing every call and tracking requested live bytes
+ */
+template<class Base>
+struct Probe : Base
+{
+    typedef typename Base::value_type value_type;
+    typedef typename Base::value_type T;
+
+    template<class U>
+    struct rebind
+    {
+        typedef Probe<typename std::allocator_traits<Base>::template rebind_alloc<U>> other;
+    };
+
+    explicit Probe(const Base& base) : Base(base) {}
+
+    T* allocate(std::size_t n) {
+        long call = recorder.enter((long) (n * sizeof(T)));
+        auto begin = std::chrono::steady_clock::now();
+        T* p = Base::allocate(n);
+        recorder.leave(call, begin);
+        return p;
+    }
+
+    void deallocate(T* p, std::size_t n) noexcept {
+        long call = recorder.enter(-(long) (n * sizeof(T)));
+        auto begin = std::chrono::steady_clock::now();
+        Base::deallocate(p, n);
+        recorder.leave(call, begin);
+    }
+};
+
+struct Malloc
+{
+    static constexpr const char* name = "malloc";
+
+    template<class T>
+    static Probe<MallocAllocator<T>> make() {
+        return Probe<MallocAllocator<T>>(MallocAllocator<T>());
+    }
+};
+
+struct WriteQueue
+{
+    static constexpr const char* name = "write_queue";
+
+    template<class T>
+    static Probe<WriteQueueAllocator<T>> make() {
+        return Probe<WriteQueueAllocator<T>>(WriteQueueAllocator<T>(HEAP));
+    }
+};
+
+/**
+ * WriteQueueAllocator rounding every request up to a power of two, to measure what slabs save
+ */
+struct Buddy
+{
+    static constexpr const char* name = "buddy";
+
+    template<class T>
+    static Probe<WriteQueueAllocator<T>> make() {
+        Config config;
+        config.slabs = false;
+        return Probe<WriteQueueAllocator<T>>(WriteQueueAllocator<T>(HEAP, config));
+    }
+};
+
+/**
+ * Grow vectors one element at a time so every capacity step reallocates
+ */
+template<class F>
+void growth() {
+    auto alloc = F::template make<int>();
+    for (int round = 0; round < 64; round++) {
+        std::vector<int, decltype(alloc)> v(alloc);
+        for (int i = 0; i < (1 << 18); i++) {
+            v.push_back(i);
+        }
+    }
+}
+
+/**
+ * Build and tear down an unbalanced binary search tree of small nodes
+ */
+template<class F>
+void nodes() {
+    struct Node
+    {
+        long key;
+        Node* left;
+        Node* right;
+    };
+    auto alloc = F::template make<Node>();
+    std::mt19937_64 rng(1);
+    for (int round = 0; round < 8; round++) {
+        Node* root = nullptr;
+        std::vector<Node*> all;
+        for (int i = 0; i < 100000; i++) {
+            Node* node = alloc.allocate(1);
+            *node = {(long) rng(), nullptr, nullptr};
+            Node** slot = &root;
+            while (*slot) {
+                slot = node->key < (*slot)->key ? &(*slot)->left : &(*slot)->right;
+            }
+            *slot = node;
+            all.push_back(node);
+        }
+        std::shuffle(all.begin(), all.end(), rng);
+        for (Node* node : all) {
+            alloc.deallocate(node, 1);
+        }
+    }
+}
+
+/**
+ * Replace random slots of a live set with random sizes
+ */
+template<class F>
+void churn() {
+    auto alloc = F::template make<char>();
+    std::mt19937 rng(2);
+    std::vector<std::pair<char*, size_t>> live(4096, {nullptr, 0});
+    for (int op = 0; op < 1000000; op++) {
+        auto& slot = live[rng() % live.size()];
+        if (slot.first) {
+            alloc.deallocate(slot.first, slot.second);
+        }
+        size_t size = 8 + rng() % 4088;
+        slot = {alloc.allocate(size), size};
+    }
+    for (auto& slot : live) {
+        alloc.deallocate(slot.first, slot.second);
+    }
+}
+
+/**
+ * Replace random slots of a large live set with records of the odd sizes typical of node types
+ */
+template<class F>
+void records() {
+    const size_t sizes[] = {24, 40, 72, 96};
+    auto alloc = F::template make<char>();
+    std::mt19937 rng(6);
+    std::vector<std::pair<char*, size_t>> live(200000, {nullptr, 0});
+    for (int op = 0; op < 2000000; op++) {
+        auto& slot = live[rng() % live.size()];
+        if (slot.first) {
+            alloc.deallocate(slot.first, slot.second);
+        }
+        size_t size = sizes[rng() % 4];
+        slot = {alloc.allocate(size), size};
+        slot.first[0] = 1;
+    }
+    for (auto& slot : live) {
+        alloc.deallocate(slot.first, slot.second);
+    }
+}
+
+/**
+ * Allocate batches and free them newest first
+ */
+template<class F>
+void lifo() {
+    auto alloc = F::template make<char>();
+    std::mt19937 rng(3);
+    std::vector<std::pair<char*, size_t>> stack;
+    for (int round = 0; round < 1000; round++) {
+        for (int i = 0; i < 1000; i++) {
+            size_t size = 16 + rng() % 1008;
+            stack.emplace_back(alloc.allocate(size), size);
+        }
+        while (!stack.empty()) {
+            alloc.deallocate(stack.back().first, stack.back().second);
+            stack.pop_back();
+        }
+    }
+}
+
+/**
+ * Keep a sliding window of allocations and free them oldest first
+ */
+template<class F>
+void fifo() {
+    auto alloc = F::template make<char>();
+    std::mt19937 rng(4);
+    std::deque<std::pair<char*, size_t>> queue;
+    for (int op = 0; op < 1000000; op++) {
+        size_t size = 16 + rng() % 1008;
+        queue.emplace_back(alloc.allocate(size), size);
+        if (queue.size() > 1000) {
+            alloc.deallocate(queue.front().first, queue.front().second);
+            queue.pop_front();
+        }
+    }
+    for (auto& entry : queue) {
+        alloc.deallocate(entry.first, entry.second);
+    }
+}
+
+/**
+ * Hand messages from a producer thread to a consumer thread that frees them
+ */
+template<class F>
+void pipeline() {
+    auto alloc = F::template make<char>();
+    std::mutex mutex;
+    std::condition_variable ready;
+    std::deque<std::pair<char*, size_t>> queue;
+    bool done = false;
+
+    std::thread consumer([&] {
+        std::unique_lock<std::mutex> guard(mutex);
+        while (!done || !queue.empty()) {
+            ready.wait(guard, [&] { return done || !queue.empty(); });
+            std::deque<std::pair<char*, size_t>> batch;
+            batch.swap(queue);
+            guard.unlock();
+            for (auto& message : batch) {
+                alloc.deallocate(message.first, message.second);
+            }
+            guard.lock();
+        }
+    });
+
+    std::mt19937 rng(5);
+    for (int i = 0; i < 1000000; i++) {
+        size_t size = 64 + rng() % 960;
+        char* message = alloc.allocate(size);
+        message[0] = (char) i;
+        std::lock_guard<std::mutex> guard(mutex);
+        queue.emplace_back(message, size);
+        if (queue.size() >= 64) {
+            ready.notify_one();
+        }
+    }
+    {
+        std::lock_guard<std::mutex> guard(mutex);
+        done = true;
+    }
+    ready.notify_one();
+    consumer.join();
+}
+
+/**
+ * Results of one workload on one allocator
+ */
+struct Result
+{
+    double mops;
+    uint32_t p50, p99, p999;
+    long requested;
+    long resident;
+};
+
+/**
+ * Run a workload in a child process so resident memory is measured in isolation
+ * @param workload workload to run
+ * @param result measurements, with peak requested bytes and peak resident KiB
+ * @return whether the child completed
+ */
+static bool isolate(void (*workload)(), Result& result) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+        //MallocAllocator reports every call, keep that out of the measurement
+        std::cout.setstate(std::ios::badbit);
+        recorder.prepare();
+
+        auto begin = std::chrono::steady_clock::now();
+        workload();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - begin;
+
+        //Sort in place, a copy of the samples would show up in the resident set
+        long count = std::min((long) recorder.calls, SAMPLES);
+        std::sort(recorder.latencies, recorder.latencies + count);
+        auto at = [&](double q) { return count ? recorder.latencies[(long) (q * (double) (count - 1))] : 0; };
+        Result child = {(double) recorder.calls / elapsed.count() / 1e6, at(0.5), at(0.99), at(0.999),
+                        recorder.peak, 0};
+        ssize_t written = write(fds[1], &child, sizeof(child));
+        _exit(written == sizeof(child) ? 0 : 1);
+    }
+
+    close(fds[1]);
+    ssize_t got = read(fds[0], &result, sizeof(result));
+    close(fds[0]);
+    int status = 0;
+    rusage usage{};
+    wait4(pid, &status, 0, &usage);
+    result.resident = usage.ru_maxrss;
+    return got == sizeof(result) && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/**
+ * Run a workload and print its row
+ * @param workload workload name
+ * @param run workload instantiated for the allocator
+ */
+template<class F>
+void report(const char* workload, void (*run)()) {
+    //Resident memory of a child that allocates nothing, subtracted before computing fragmentation
+    static long floor = -1;
+    if (floor < 0) {
+        Result empty{};
+        isolate([] {}, empty);
+        floor = empty.resident;
+    }
+
+    Result result{};
+    if (!isolate(run, result)) {
+        printf("%-10s %-12s %10s\n", workload, F::name, "failed");
+        return;
+    }
+
+    //Share of the memory the workload made resident that never held requested bytes at the peak
+    double used = (double) (result.resident - floor) * 1024;
+    double fragmentation = used > 0 ? std::max(0.0, 1 - (double) result.requested / used) : 0;
+    printf("%-10s %-12s %10.2f %8u %8u %8u %10.1f %8.1f%%\n", workload, F::name, result.mops, result.p50,
+           result.p99, result.p999, used / (1 << 20), 100 * fragmentation);
+}
+
+/**
+ * Run a workload against every allocator
+ */
+#define compare(name, workload) \
+    report<Malloc>(name, workload<Malloc>); \
+    report<WriteQueue>(name, workload<WriteQueue>); \
+    report<Buddy>(name, workload<Buddy>)
+
+int main() {
+    //Peak resident memory is reported above that of a child which allocates nothing
+    printf("%-10s %-12s %10s %8s %8s %8s %10s %9s\n", "workload", "allocator", "Mops/s", "p50 ns", "p99 ns",
+           "p999 ns", "peak MiB", "frag");
+    compare("growth", growth);
+    compare("nodes", nodes);
+    compare("churn", churn);
+    compare("records", records);
+    compare("lifo", lifo);
+    compare("fifo", fifo);
+    compare("pipeline", pipeline);
+}
@@ -14,5 +14,5 @@ int main() {
     std::vector<int, WriteQueueAllocator<int>> v2(8, a);
     v.push_back(42);
 
-    display(&a.tree, false);
+    display(&a.arena->regions[0].tree, false);
 }
\ No newline at end of file
@@ -0,0 +1,81 @@
+#include <cstdio>
+#include <new>
+
+#include "../allocators/write_queue/Buffer.h"
+#include "../allocators/write_queue/Buffer.cpp"
+#include "../allocators/write_queue/WriteQueueAllocator.h"
+#include "../allocators/write_queue/WriteQueueAllocator.cpp"
+
+/**
+ * Regression tests for requests whose blocks round up to the large threshold. Each round frees what it took, so
+ * a block freed down the wrong path leaks and the arena runs out long before the rounds do.
+ */
+
+//Bytes of heap under each allocator, a few dozen blocks of the threshold
+#define HEAP (64L << 20)
+
+//Rounds of each test, several times what a leak of one block per round would exhaust
+#define ROUNDS 1000
+
+/**
+ * Take every size between half the threshold and the threshold with allocate_at_least, giving back the count it
+ * reported
+ * @return whether every round was served
+ */
+static bool at_least() {
+    WriteQueueAllocator<char> allocator(HEAP);
+    long large = (long) allocator.arena->config.large;
+    long step = large / 2 / ROUNDS;
+    try {
+        for (long size = large / 2; size < large; size += step) {
+            allocation_result<char*> result = allocator.allocate_at_least((size_t) size);
+            if (allocator.arena->large((long) result.count)) {
+                return false;
+            }
+            allocator.deallocate(result.ptr, result.count);
+        }
+    }
+    catch (std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+/**
+ * Reserve buffers on either side of the threshold, whose headroom would otherwise cross it, and destroy them
+ * @return whether every round was served and kept its capacity on the side of its request
+ */
+static bool headroom() {
+    WriteQueueAllocator<char> allocator(HEAP);
+    long large = (long) allocator.arena->config.large;
+    const long sizes[] = {large / 8, large / 5, large / 3, large / 2 + 1, large - 1, large + 1};
+    try {
+        for (int round = 0; round < ROUNDS; round++) {
+            long size = sizes[round % (sizeof(sizes) / sizeof(*sizes))];
+            Buffer<char> buffer(allocator);
+            buffer.reserve((size_t) size);
+            if (allocator.arena->large((long) buffer.capacity()) != allocator.arena->large(size)) {
+                return false;
+            }
+        }
+    }
+    catch (std::bad_alloc&) {
+        return false;
+    }
+    return true;
+}
+
+int main() {
+    bool passed = true;
+    struct
+    {
+        const char* name;
+        bool (*run)();
+    } tests[] = {{"allocate_at_least below large", at_least}, {"buffer headroom below large", headroom}};
+    for (auto& test : tests) {
+        bool ok = test.run();
+        printf("%-40s %s\n", test.name, ok ? "ok" : "FAILED");
+        passed &= ok;
+    }
+    return passed ? 0 : 1;
+}